@@ -0,0 +1,212 @@
+#pragma once
+#include "enums.hpp"
+#include "policies.hpp"
+#include "types.hpp"
+#include <array>
+#include <cstddef>
+#include <optional>
+#include <string_view>
+
+namespace SimpleMatchingEngine {
+    // Comma separated fields of a wire message. Views are only valid while the message is.
+    struct Tokens
+    {
+        static constexpr std::size_t MAX_TOKENS = 8;
+
+        std::array<std::string_view, MAX_TOKENS> items{};
+        std::size_t count = 0;
+
+        std::string_view operator[](std::size_t index) const noexcept {
+            return items[index];
+        }
+
+        std::size_t size() const noexcept {
+            return count;
+        }
+    };
+
+    // Parsed messages. Nothing here owns memory, an order is only built once it reaches the order store.
+    template <typename Price>
+    struct InsertCommand
+    {
+        OrderIdType order_id;
+        std::string_view symbol;
+        Side side;
+        Price price;
+        VolumeType volume;
+        StpGroupType stp_group;
+        SelfTradePrevention stp_mode;
+    };
+
+    template <typename Price>
+    struct AmendCommand
+    {
+        OrderIdType order_id;
+        Price price;
+        VolumeType volume;
+    };
+
+    struct PullCommand
+    {
+        OrderIdType order_id;
+    };
+
+    // No limit price makes a plain stop, it then trades whatever is on the other side
+    template <typename Price>
+    struct StopCommand
+    {
+        OrderIdType order_id;
+        std::string_view symbol;
+        Side side;
+        Price trigger_price;
+        VolumeType volume;
+        OrderType type;
+        Price limit_price;
+    };
+
+    // AUCTION and UNCROSS only name the symbol whose trading phase changes
+    struct PhaseCommand
+    {
+        std::string_view symbol;
+    };
+
+    // Decoding never throws: an empty optional means the field is invalid
+    Tokens tokenize(std::string_view wire) noexcept;
+    std::optional<Command> command_from_string(std::string_view cmd) noexcept;
+    std::optional<OrderIdType> order_id_from_string(std::string_view order_id) noexcept;
+    std::optional<StpGroupType> stp_group_from_string(std::string_view stp_group) noexcept;
+    std::optional<VolumeType> validate_volume(std::string_view volume) noexcept;
+    std::optional<Side> side_from_string(std::string_view side) noexcept;
+    std::optional<SelfTradePrevention> stp_mode_from_string(std::string_view stp_mode) noexcept;
+    bool validate_price_format(std::string_view price) noexcept;
+
+    template <typename P>
+    requires PricePolicy<P>
+    std::optional<typename P::value_type> validate_price(std::string_view price)
+    {
+        if (!validate_price_format(price))
+            return std::nullopt;
+
+        return P::parse(price);
+    }
+
+    // INSERT,order id,symbol,side,price,volume[,stp group[,stp mode]]
+    template <typename P>
+    requires PricePolicy<P>
+    RejectCode parse_insert(const Tokens &tokens, InsertCommand<typename P::value_type> &command)
+    {
+        if (tokens.size() < 6)
+            return RejectCode::MALFORMED_MESSAGE;
+
+        const auto order_id = order_id_from_string(tokens[1]);
+        if (!order_id)
+            return RejectCode::INVALID_ORDER_ID;
+
+        const auto side = side_from_string(tokens[3]);
+        if (!side)
+            return RejectCode::INVALID_SIDE;
+
+        auto price = validate_price<P>(tokens[4]);
+        if (!price)
+            return RejectCode::INVALID_PRICE;
+
+        // Zero only means something to AMEND, where it pulls the order
+        const auto volume = validate_volume(tokens[5]);
+        if (!volume || *volume == 0)
+            return RejectCode::INVALID_VOLUME;
+
+        // STP mode defaults to cancel newest once a group is given
+        const auto stp_group = tokens.size() > 6 ? stp_group_from_string(tokens[6]) : std::optional<StpGroupType>(0);
+        auto stp_mode = std::optional<SelfTradePrevention>(SelfTradePrevention::DISABLED);
+        if (stp_group && *stp_group != 0)
+            stp_mode = tokens.size() > 7 ? stp_mode_from_string(tokens[7]) : SelfTradePrevention::CANCEL_NEWEST;
+
+        if (!stp_group || !stp_mode)
+            return RejectCode::INVALID_STP;
+
+        command = { *order_id, tokens[2], *side, std::move(*price), *volume, *stp_group, *stp_mode };
+        return RejectCode::ACCEPTED;
+    }
+
+    // AMEND,order id,price,volume
+    template <typename P>
+    requires PricePolicy<P>
+    RejectCode parse_amend(const Tokens &tokens, AmendCommand<typename P::value_type> &command)
+    {
+        if (tokens.size() < 4)
+            return RejectCode::MALFORMED_MESSAGE;
+
+        const auto order_id = order_id_from_string(tokens[1]);
+        if (!order_id)
+            return RejectCode::INVALID_ORDER_ID;
+
+        auto price = validate_price<P>(tokens[2]);
+        if (!price)
+            return RejectCode::INVALID_PRICE;
+
+        const auto volume = validate_volume(tokens[3]);
+        if (!volume)
+            return RejectCode::INVALID_VOLUME;
+
+        command = { *order_id, std::move(*price), *volume };
+        return RejectCode::ACCEPTED;
+    }
+
+    // PULL,order id
+    inline RejectCode parse_pull(const Tokens &tokens, PullCommand &command) noexcept
+    {
+        if (tokens.size() < 2)
+            return RejectCode::MALFORMED_MESSAGE;
+
+        const auto order_id = order_id_from_string(tokens[1]);
+        if (!order_id)
+            return RejectCode::INVALID_ORDER_ID;
+
+        command = { *order_id };
+        return RejectCode::ACCEPTED;
+    }
+
+    // STOP,order id,symbol,side,trigger price,volume[,limit price]
+    template <typename P>
+    requires PricePolicy<P>
+    RejectCode parse_stop(const Tokens &tokens, StopCommand<typename P::value_type> &command)
+    {
+        if (tokens.size() < 6)
+            return RejectCode::MALFORMED_MESSAGE;
+
+        const auto order_id = order_id_from_string(tokens[1]);
+        if (!order_id)
+            return RejectCode::INVALID_ORDER_ID;
+
+        const auto side = side_from_string(tokens[3]);
+        if (!side)
+            return RejectCode::INVALID_SIDE;
+
+        auto trigger_price = validate_price<P>(tokens[4]);
+        if (!trigger_price)
+            return RejectCode::INVALID_PRICE;
+
+        const auto volume = validate_volume(tokens[5]);
+        if (!volume || *volume == 0)
+            return RejectCode::INVALID_VOLUME;
+
+        // A plain stop keeps its trigger as a placeholder limit
+        auto limit_price = tokens.size() > 6 ? validate_price<P>(tokens[6]) : trigger_price;
+        if (!limit_price)
+            return RejectCode::INVALID_PRICE;
+
+        const auto type = tokens.size() > 6 ? OrderType::STOP_LIMIT : OrderType::STOP_LOSS;
+        command = { *order_id, tokens[2], *side, std::move(*trigger_price), *volume, type, std::move(*limit_price) };
+        return RejectCode::ACCEPTED;
+    }
+
+    // AUCTION,symbol or UNCROSS,symbol
+    inline RejectCode parse_phase(const Tokens &tokens, PhaseCommand &command) noexcept
+    {
+        if (tokens.size() < 2)
+            return RejectCode::MALFORMED_MESSAGE;
+
+        command = { tokens[1] };
+        return RejectCode::ACCEPTED;
+    }
+}
@@ -1,32 +1,477 @@
 #pragma once
+#include "commands.hpp"
 #include "enums.hpp"
+#include "market_data.hpp"
+#include "metrics.hpp"
 #include "order.hpp"
 #include "orderbook.hpp"
+#include "policies.hpp"
 #include "types.hpp"
+#include <cassert>
+#include <functional>
+#include <map>
 #include <memory>
+#include <optional>
+#include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace SimpleMatchingEngine {
-    class MatchingEngine final
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    class BasicMatchingEngine final
     {
     public:
-        MatchingEngine();
-        void process(const std::string &wire, std::vector<std::string> &trades);
+        using policy_type = Policy;
+        using order_type = BasicOrder<Policy>;
+        using orderbook_type = BasicOrderbook<Policy>;
+        using order_store_type = typename orderbook_type::order_store_type;
+        using output_type = typename orderbook_type::output_type;
+        using event_sink = typename orderbook_type::event_sink;
+        using price_policy = typename Policy::price_policy;
+        using insert_command = InsertCommand<typename price_policy::value_type>;
+        using amend_command = AmendCommand<typename price_policy::value_type>;
+        using stop_command = StopCommand<typename price_policy::value_type>;
+        using indicative_uncross_type = IndicativeUncross<typename price_policy::value_type>;
+
+        BasicMatchingEngine();
+        // Invalid messages are reported to the event sink as rejects, nothing is thrown
+        void process(std::string_view wire, output_type &trades) noexcept;
+        // Messages decoded already, e.g. from a binary capture: the same events as their wire form
+        void process(const insert_command &command, output_type &trades) noexcept;
+        void process(const amend_command &command, output_type &trades) noexcept;
+        void process(const PullCommand &command, output_type &trades) noexcept;
+        void process(const stop_command &command, output_type &trades) noexcept;
+        // phase is AUCTION or UNCROSS
+        void process(Command phase, const PhaseCommand &command, output_type &trades) noexcept;
         std::vector<std::string> publish_books() const noexcept;
+        // Books are published to shared memory after every accepted message from then on
+        void attach_publisher(MarketData::ShmBookPublisher *publisher) noexcept;
+        // Clearing price and volume if the symbol's auction was uncrossed now. Empty for an unknown symbol.
+        std::optional<indicative_uncross_type> indicative_uncross(std::string_view symbol) const noexcept;
 
     private:
-        void process_insert_order(const Order &order, std::vector<std::string> &trades) noexcept;
-        void process_amend_order(const Order &order, std::vector<std::string> &trades);
-        void process_pull_order(const Order &order);
-        void update_timestamp() noexcept;
+        // Heterogeneous lookup so a symbol is only copied the first time it is seen
+        using orderbook_map_type = std::map<Unqualified<SymbolType>, orderbook_type, std::less<>>;
+
+        RejectCode dispatch(const Tokens &tokens, output_type &trades) noexcept;
+        RejectCode process_phase(Command phase, const PhaseCommand &command, output_type &trades) noexcept;
+        void complete(RejectCode reject, OrderIdType order_id, output_type &trades) noexcept;
+        RejectCode process_insert_order(const insert_command &command, output_type &trades) noexcept;
+        RejectCode process_amend_order(const amend_command &command, output_type &trades) noexcept;
+        RejectCode process_pull_order(const PullCommand &command) noexcept;
+        RejectCode process_stop_order(const stop_command &command) noexcept;
+        RejectCode process_auction(const PhaseCommand &command) noexcept;
+        RejectCode process_uncross(const PhaseCommand &command, output_type &trades) noexcept;
+        void next_sequence() noexcept;
+        void publish_depth() noexcept;
 
-        Orderbook &retrieve_orderbook(const Order &order);
-        static Command command_from_string(const std::string &cmd);
+        orderbook_type &retrieve_orderbook(const order_type &order) noexcept;
+        typename orderbook_map_type::iterator find_or_add_orderbook(std::string_view symbol);
+        // end() when the id is live already: a rejected order must not create a book
+        typename orderbook_map_type::iterator orderbook_for_new_order(OrderIdType order_id, std::string_view symbol);
 
     private:
-        std::unique_ptr<OrdersMapType> orders_by_id_;
-        std::map<Unqualified<SymbolType>, Orderbook> orderbooks_;
-        TimeStampType timestamp_;
+        std::unique_ptr<order_store_type> orders_by_id_;
+        orderbook_map_type orderbooks_;
+        // Shared with the orderbooks, which hand new sequences to triggered stops
+        SequenceType sequence_;
+        MarketData::ShmBookPublisher *publisher_;
+        // The book the last accepted message went to
+        orderbook_type *last_book_;
+        MarketData::BookDepth depth_;
     };
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    BasicMatchingEngine<Policy>::BasicMatchingEngine()
+        : orders_by_id_(std::make_unique<order_store_type>()), sequence_(0), publisher_(nullptr), last_book_(nullptr)
+    {}
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicMatchingEngine<Policy>::process(std::string_view wire, output_type &trades) noexcept
+    {
+        SME_METRICS_MESSAGE();
+
+        const auto tokens = tokenize(wire);
+        const auto reject = dispatch(tokens, trades);
+        complete(reject, reject != RejectCode::ACCEPTED ? order_id_from_string(tokens[1]).value_or(0) : 0, trades);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicMatchingEngine<Policy>::process(const insert_command &command, output_type &trades) noexcept
+    {
+        SME_METRICS_MESSAGE();
+        complete(process_insert_order(command, trades), command.order_id, trades);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicMatchingEngine<Policy>::process(const amend_command &command, output_type &trades) noexcept
+    {
+        SME_METRICS_MESSAGE();
+        complete(process_amend_order(command, trades), command.order_id, trades);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicMatchingEngine<Policy>::process(const PullCommand &command, output_type &trades) noexcept
+    {
+        SME_METRICS_MESSAGE();
+        complete(process_pull_order(command), command.order_id, trades);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicMatchingEngine<Policy>::process(const stop_command &command, output_type &trades) noexcept
+    {
+        SME_METRICS_MESSAGE();
+        complete(process_stop_order(command), command.order_id, trades);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicMatchingEngine<Policy>::process(Command phase, const PhaseCommand &command, output_type &trades) noexcept
+    {
+        SME_METRICS_MESSAGE();
+        complete(process_phase(phase, command, trades), 0, trades);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicMatchingEngine<Policy>::complete(RejectCode reject, OrderIdType order_id, output_type &trades) noexcept
+    {
+        if (reject != RejectCode::ACCEPTED) [[unlikely]]
+            event_sink::on_reject(trades, reject, order_id);
+        else if (publisher_)
+            publish_depth();
+
+        // Time passes...
+        next_sequence();
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    RejectCode BasicMatchingEngine<Policy>::dispatch(const Tokens &tokens, output_type &trades) noexcept
+    {
+        SME_METRICS_TIMER(parse_start);
+
+        const auto cmd = command_from_string(tokens[0]);
+        if (!cmd)
+            return RejectCode::UNKNOWN_COMMAND;
+
+        switch (*cmd) {
+            case Command::INSERT:
+            {
+                insert_command command{};
+                if (const auto reject = parse_insert<price_policy>(tokens, command); reject != RejectCode::ACCEPTED)
+                    return reject;
+
+                SME_METRICS_ELAPSED(parse_start, Metrics::Stage::PARSE);
+                return process_insert_order(command, trades);
+            }
+            case Command::AMEND:
+            {
+                amend_command command{};
+                if (const auto reject = parse_amend<price_policy>(tokens, command); reject != RejectCode::ACCEPTED)
+                    return reject;
+
+                SME_METRICS_ELAPSED(parse_start, Metrics::Stage::PARSE);
+                return process_amend_order(command, trades);
+            }
+            case Command::PULL:
+            {
+                PullCommand command{};
+                if (const auto reject = parse_pull(tokens, command); reject != RejectCode::ACCEPTED)
+                    return reject;
+
+                SME_METRICS_ELAPSED(parse_start, Metrics::Stage::PARSE);
+                return process_pull_order(command);
+            }
+            case Command::AUCTION:
+            case Command::UNCROSS:
+            {
+                PhaseCommand command{};
+                if (const auto reject = parse_phase(tokens, command); reject != RejectCode::ACCEPTED)
+                    return reject;
+
+                SME_METRICS_ELAPSED(parse_start, Metrics::Stage::PARSE);
+                return process_phase(*cmd, command, trades);
+            }
+            case Command::STOP:
+            {
+                stop_command command{};
+                if (const auto reject = parse_stop<price_policy>(tokens, command); reject != RejectCode::ACCEPTED)
+                    return reject;
+
+                SME_METRICS_ELAPSED(parse_start, Metrics::Stage::PARSE);
+                return process_stop_order(command);
+            }
+        }
+
+        return RejectCode::UNKNOWN_COMMAND;
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    std::vector<std::string> BasicMatchingEngine<Policy>::publish_books() const noexcept {
+        std::vector<std::string> ret;
+
+        for (auto &[symbol, book] : orderbooks_) {
+            std::ostringstream oss;
+            oss << "===" << symbol << "===";
+            ret.push_back(oss.str());
+
+            auto levels = book.print_levels();
+            ret.insert(ret.end(), levels.begin(), levels.end());
+        }
+
+        return ret;
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    std::optional<typename BasicMatchingEngine<Policy>::indicative_uncross_type>
+    BasicMatchingEngine<Policy>::indicative_uncross(std::string_view symbol) const noexcept
+    {
+        auto iter = orderbooks_.find(symbol);
+        if (iter == orderbooks_.end())
+            return std::nullopt;
+
+        return iter->second.indicative_uncross();
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicMatchingEngine<Policy>::attach_publisher(MarketData::ShmBookPublisher *publisher) noexcept
+    {
+        publisher_ = publisher;
+        for (auto &[symbol, book] : orderbooks_) {
+            book.set_market_data_slot(publisher_ ? publisher_->slot_for(symbol) : -1);
+            if (!publisher_)
+                continue;
+
+            // Books that existed before are published straight away
+            last_book_ = &book;
+            publish_depth();
+        }
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicMatchingEngine<Policy>::publish_depth() noexcept
+    {
+        const auto slot = last_book_->get_market_data_slot();
+        if (slot < 0)
+            return;
+
+        last_book_->snapshot_depth(depth_, publisher_->depth());
+        publisher_->publish(slot, depth_);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    RejectCode BasicMatchingEngine<Policy>::process_insert_order(const insert_command &command, output_type &trades) noexcept
+    {
+        auto iter = orderbook_for_new_order(command.order_id, command.symbol);
+        if (iter == orderbooks_.end())
+            return RejectCode::DUPLICATE_ORDER_ID;
+
+        // Build the order straight into the pool of orders. It refers to the orderbook key for its symbol.
+        auto inserted = [&] {
+            SME_METRICS_STAGE(Metrics::Stage::ORDER_MAP_INSERT);
+            SME_METRICS_COUNT(Metrics::Counter::HASH_LOOKUPS, 1);
+            return orders_by_id_->try_emplace(command.order_id, command.order_id, iter->first, command.side, command.price,
+                                              command.volume, sequence_, command.stp_group, command.stp_mode);
+        }();
+
+        if (!inserted.second) {
+            // An order with this id is live already, leave it alone
+            return RejectCode::DUPLICATE_ORDER_ID;
+        }
+
+        auto &orderbook = iter->second;
+        orderbook.process_insert_order(inserted.first->second, trades);
+        last_book_ = &orderbook;
+        return RejectCode::ACCEPTED;
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    RejectCode BasicMatchingEngine<Policy>::process_amend_order(const amend_command &command, output_type &trades) noexcept
+    {
+        // If amend volume is 0 we pull the order
+        if (command.volume == 0)
+            return process_pull_order(PullCommand{ command.order_id });
+
+        SME_METRICS_COUNT(Metrics::Counter::HASH_LOOKUPS, 1);
+        auto order_iter = orders_by_id_->find(command.order_id);
+        if (order_iter == orders_by_id_->end()) {
+            // The order doesn't exist. Maybe it's been matched or cancelled before we could amend it ?
+            return RejectCode::UNKNOWN_ORDER;
+        }
+
+        auto &existing = order_iter->second;
+        if (existing.is_pending_stop()) {
+            // Stops are pulled and sent again instead
+            return RejectCode::PENDING_STOP;
+        }
+
+        auto &orderbook = retrieve_orderbook(existing);
+        if (command.price == existing.get_price() && command.volume <= existing.get_volume()) {
+            // If we are not changing the price and the volume is not increasing the order keeps its priority
+            existing.set_sequence(sequence_);
+            orderbook.process_amend_order(existing, command.volume, trades);
+        } else {
+            // Otherwise it ends at the bottom of the queue.
+            orderbook.process_pull_order(existing);
+            existing.set_price(command.price);
+            existing.set_volume(command.volume);
+            existing.set_sequence(sequence_);
+            orderbook.process_insert_order(existing, trades);
+        }
+
+        last_book_ = &orderbook;
+        return RejectCode::ACCEPTED;
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    RejectCode BasicMatchingEngine<Policy>::process_pull_order(const PullCommand &command) noexcept
+    {
+        SME_METRICS_COUNT(Metrics::Counter::HASH_LOOKUPS, 1);
+        auto order_iter = orders_by_id_->find(command.order_id);
+        if (order_iter == orders_by_id_->end()) {
+            // The order doesn't exist. Maybe it's been matched before we could cancel it ?
+            return RejectCode::UNKNOWN_ORDER;
+        }
+
+        const auto &existing = order_iter->second;
+
+        auto &orderbook = retrieve_orderbook(existing);
+        orderbook.process_pull_order(existing);
+        last_book_ = &orderbook;
+
+        orders_by_id_->erase(order_iter);
+        return RejectCode::ACCEPTED;
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    RejectCode BasicMatchingEngine<Policy>::process_stop_order(const stop_command &command) noexcept
+    {
+        auto iter = orderbook_for_new_order(command.order_id, command.symbol);
+        if (iter == orderbooks_.end())
+            return RejectCode::DUPLICATE_ORDER_ID;
+
+        // Pending stops live in the pool of orders too, so ids stay unique and PULL finds them
+        SME_METRICS_COUNT(Metrics::Counter::HASH_LOOKUPS, 1);
+        auto inserted = orders_by_id_->try_emplace(command.order_id, command.order_id, iter->first, command.side, command.limit_price, command.volume,
+                                                   sequence_, 0, SelfTradePrevention::DISABLED, command.type, command.trigger_price);
+        if (!inserted.second)
+            return RejectCode::DUPLICATE_ORDER_ID;
+
+        auto &orderbook = iter->second;
+        orderbook.process_stop_order(inserted.first->second);
+        last_book_ = &orderbook;
+        return RejectCode::ACCEPTED;
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    RejectCode BasicMatchingEngine<Policy>::process_phase(Command phase, const PhaseCommand &command, output_type &trades) noexcept
+    {
+        return phase == Command::AUCTION ? process_auction(command) : process_uncross(command, trades);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    RejectCode BasicMatchingEngine<Policy>::process_auction(const PhaseCommand &command) noexcept
+    {
+        // Pre-open usually comes before the first order for the symbol
+        auto &orderbook = find_or_add_orderbook(command.symbol)->second;
+        if (orderbook.in_auction())
+            return RejectCode::INVALID_PHASE;
+
+        orderbook.start_auction();
+        last_book_ = &orderbook;
+        return RejectCode::ACCEPTED;
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    RejectCode BasicMatchingEngine<Policy>::process_uncross(const PhaseCommand &command, output_type &trades) noexcept
+    {
+        auto iter = orderbooks_.find(command.symbol);
+        if (iter == orderbooks_.end())
+            return RejectCode::UNKNOWN_SYMBOL;
+
+        auto &orderbook = iter->second;
+        if (!orderbook.in_auction())
+            return RejectCode::INVALID_PHASE;
+
+        orderbook.uncross_auction(trades);
+        last_book_ = &orderbook;
+        return RejectCode::ACCEPTED;
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicMatchingEngine<Policy>::next_sequence() noexcept
+    {
+        ++sequence_;
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    typename BasicMatchingEngine<Policy>::orderbook_map_type::iterator
+    BasicMatchingEngine<Policy>::find_or_add_orderbook(std::string_view symbol)
+    {
+        // Check if we already have an orderbook for the symbol.
+        // If we don't, let's add it.
+        auto iter = orderbooks_.find(symbol);
+        if (iter == orderbooks_.end()) {
+            iter = orderbooks_.try_emplace(Unqualified<SymbolType>(symbol), orders_by_id_.get(), &sequence_).first;
+            if (publisher_)
+                iter->second.set_market_data_slot(publisher_->slot_for(iter->first));
+        }
+
+        return iter;
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    typename BasicMatchingEngine<Policy>::orderbook_map_type::iterator
+    BasicMatchingEngine<Policy>::orderbook_for_new_order(OrderIdType order_id, std::string_view symbol)
+    {
+        auto iter = orderbooks_.find(symbol);
+        if (iter != orderbooks_.end())
+            return iter;
+
+        // Only the first order of a symbol pays for this lookup, try_emplace catches duplicates otherwise
+        SME_METRICS_COUNT(Metrics::Counter::HASH_LOOKUPS, 1);
+        if (orders_by_id_->find(order_id) != orders_by_id_->end())
+            return orderbooks_.end();
+
+        return find_or_add_orderbook(symbol);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    typename BasicMatchingEngine<Policy>::orderbook_type &BasicMatchingEngine<Policy>::retrieve_orderbook(const order_type &order) noexcept {
+        auto orderbook_iter = orderbooks_.find(order.get_symbol());
+
+        // Orderbooks are never removed and a live order always has one
+        assert(orderbook_iter != orderbooks_.end());
+        return orderbook_iter->second;
+    }
+
+    extern template class BasicMatchingEngine<ReferencePolicy>;
+    extern template class BasicMatchingEngine<FlatBookPolicy>;
+    extern template class BasicMatchingEngine<DefaultPolicy>;
+
+    using MatchingEngine = BasicMatchingEngine<DefaultPolicy>;
 }
@@ -3,9 +3,12 @@
 namespace SimpleMatchingEngine {
     enum Command
     {
-        INSERT = 0,
-        AMEND  = 1,
-        PULL   = 2
+        INSERT  = 0,
+        AMEND   = 1,
+        PULL    = 2,
+        AUCTION = 3,
+        UNCROSS = 4,
+        STOP    = 5
     };
 
     enum Side
@@ -14,4 +17,57 @@ namespace SimpleMatchingEngine {
         BUY  = 0,
         SELL = 1
     };
+
+    // Stops wait in the trigger index until a trade reaches their trigger price.
+    // A stop then trades like a market order, a stop-limit rests as a limit order.
+    enum OrderType
+    {
+        LIMIT      = 0,
+        STOP_LOSS  = 1,
+        STOP_LIMIT = 2
+    };
+
+    // Applied when an incoming order would trade against a resting order
+    // sharing its STP group. The mode of the aggressor (newest) order wins.
+    enum SelfTradePrevention
+    {
+        DISABLED             = 0,
+        CANCEL_NEWEST        = 1,
+        CANCEL_OLDEST        = 2,
+        CANCEL_BOTH          = 3,
+        DECREMENT_AND_CANCEL = 4
+    };
+
+    enum EventType
+    {
+        TRADE  = 0,
+        REJECT = 1,
+        CANCEL = 2
+    };
+
+    // Why a message was not applied. Reported through the event sink, never thrown.
+    enum RejectCode
+    {
+        ACCEPTED           = 0,
+        UNKNOWN_COMMAND    = 1,
+        MALFORMED_MESSAGE  = 2,
+        INVALID_ORDER_ID   = 3,
+        INVALID_SIDE       = 4,
+        INVALID_PRICE      = 5,
+        INVALID_VOLUME     = 6,
+        INVALID_STP        = 7,
+        UNKNOWN_ORDER      = 8,
+        DUPLICATE_ORDER_ID = 9,
+        UNKNOWN_SYMBOL     = 10,
+        INVALID_PHASE      = 11,
+        PENDING_STOP       = 12
+    };
+
+    inline const char *reject_code_to_string(RejectCode code) noexcept
+    {
+        static constexpr const char *names[] = { "ACCEPTED", "UNKNOWN_COMMAND", "MALFORMED_MESSAGE", "INVALID_ORDER_ID", "INVALID_SIDE",
+                                                 "INVALID_PRICE", "INVALID_VOLUME", "INVALID_STP", "UNKNOWN_ORDER", "DUPLICATE_ORDER_ID",
+                                                 "UNKNOWN_SYMBOL", "INVALID_PHASE", "PENDING_STOP" };
+        return names[code];
+    }
 }
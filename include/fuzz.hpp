@@ -0,0 +1,103 @@
+#pragma once
+#include "engine.hpp"
+#include "naive.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace SimpleMatchingEngine::Fuzz {
+    struct Options
+    {
+        std::uint64_t seed = 1;
+        std::size_t messages = 10000;
+        int symbols = 3;
+    };
+
+    // Seeded order flow around a few prices per symbol: crossing inserts, priority keeping and
+    // losing amends, pulls of live and dead ids, stops, auctions and a sprinkle of rejects.
+    // Prices cross powers of ten and zero and are now and then spelled with extra zeros, so
+    // an engine that orders or prints prices by their text diverges.
+    std::vector<std::string> generate(const Options &options);
+
+    struct Divergence
+    {
+        std::size_t message;    // index of the message, the stream size for the final books
+        std::string reference;
+        std::string candidate;
+    };
+
+    // Output of one message, or of publish_books() once the stream is done
+    template <typename Engine>
+    class Runner final
+    {
+    public:
+        const std::vector<std::string> &process(const std::string &wire) {
+            output_.clear();
+            engine_.process(wire, output_);
+            return output_;
+        }
+
+        std::vector<std::string> books() const {
+            return engine_.publish_books();
+        }
+
+    private:
+        Engine engine_;
+        std::vector<std::string> output_;
+    };
+
+    inline std::string join(const std::vector<std::string> &lines)
+    {
+        std::string joined;
+        for (const auto &line : lines)
+            joined.append(line).push_back('\n');
+
+        return joined;
+    }
+
+    // Everything both engines print must be byte for byte the same
+    template <typename Candidate, typename Reference = NaiveEngine>
+    std::optional<Divergence> compare(const std::vector<std::string> &messages)
+    {
+        Runner<Reference> reference;
+        Runner<Candidate> candidate;
+
+        for (std::size_t i = 0; i < messages.size(); ++i) {
+            const auto &expected = reference.process(messages[i]);
+            const auto &actual = candidate.process(messages[i]);
+            if (expected != actual)
+                return Divergence{ i, join(expected), join(actual) };
+        }
+
+        const auto expected = reference.books();
+        const auto actual = candidate.books();
+        if (expected != actual)
+            return Divergence{ messages.size(), join(expected), join(actual) };
+
+        return std::nullopt;
+    }
+
+    // Drops messages for as long as the stream keeps failing. The result is 1-minimal:
+    // removing any single message left makes the failure go away.
+    std::vector<std::string> shrink(std::vector<std::string> messages, const std::function<bool(const std::vector<std::string> &)> &fails);
+
+    // Seconds to process the whole stream, output included
+    template <typename Engine>
+    double time_engine(const std::vector<std::string> &messages)
+    {
+        Engine engine;
+        typename Engine::output_type output;
+
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto &wire : messages) {
+            engine.process(wire, output);
+            output.clear();
+        }
+
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace SimpleMatchingEngine::MarketData {
+    inline constexpr std::uint32_t MAX_DEPTH = 10;
+    inline constexpr std::size_t SYMBOL_LENGTH = 16;
+    inline constexpr std::uint64_t SEGMENT_MAGIC = 0x534d45424f4f4b31; // "SMEBOOK1"
+    inline constexpr std::uint32_t SEGMENT_VERSION = 1;
+
+    // Prices are FixedPointPrice ticks whatever the price policy of the engine
+    struct Level
+    {
+        std::int64_t price;
+        std::int64_t volume;
+
+        bool operator==(const Level &) const = default;
+    };
+
+    struct BookDepth
+    {
+        std::uint32_t bid_depth = 0;
+        std::uint32_t ask_depth = 0;
+        Level bids[MAX_DEPTH]{};
+        Level asks[MAX_DEPTH]{};
+
+        bool operator==(const BookDepth &other) const noexcept;
+    };
+
+    // Layout of the segment: one Header followed by max_symbols BookSlots
+    struct Header
+    {
+        std::uint64_t magic;
+        std::uint32_t version;
+        std::uint32_t max_symbols;
+        std::uint32_t depth;
+        std::atomic<std::uint32_t> symbol_count;
+    };
+
+    // Odd sequence: a write is in progress. The symbol is set once, before the slot is counted.
+    struct alignas(64) BookSlot
+    {
+        std::atomic<std::uint64_t> sequence;
+        char symbol[SYMBOL_LENGTH];
+        BookDepth depth;
+    };
+
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+    static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+
+    // Single writer: the engine thread owning the books. The publisher holds a lock on its segment
+    // for as long as it lives, the kernel drops it when the process dies. A segment still locked
+    // makes construction fail, a stale one is replaced, never truncated under its readers. The
+    // segment is removed on destruction.
+    class ShmBookPublisher final
+    {
+    public:
+        ShmBookPublisher(const std::string &name, std::uint32_t max_symbols, std::uint32_t depth = MAX_DEPTH);
+        ~ShmBookPublisher();
+
+        ShmBookPublisher(const ShmBookPublisher &) = delete;
+        ShmBookPublisher &operator=(const ShmBookPublisher &) = delete;
+
+        // -1 once every slot is taken, the symbol is then simply not published
+        int slot_for(std::string_view symbol) noexcept;
+        void publish(int slot, const BookDepth &depth) noexcept;
+
+        std::uint32_t depth() const noexcept {
+            return header_->depth;
+        }
+
+    private:
+        std::string name_;
+        std::size_t size_;
+        int fd_; // locked, and tells our segment from one created under the same name later
+        Header *header_;
+        BookSlot *slots_;
+        std::vector<BookDepth> published_;
+    };
+
+    // Any number of readers, in any process. Reads never block the writer.
+    class ShmBookReader final
+    {
+    public:
+        explicit ShmBookReader(const std::string &name);
+        ~ShmBookReader();
+
+        ShmBookReader(const ShmBookReader &) = delete;
+        ShmBookReader &operator=(const ShmBookReader &) = delete;
+
+        int find(std::string_view symbol) const noexcept;
+        // Returns the sequence of the consistent copy, 0 if nothing was published yet
+        std::uint64_t read(int slot, BookDepth &depth) const noexcept;
+
+    private:
+        std::size_t size_;
+        const Header *header_;
+        const BookSlot *slots_;
+    };
+}
@@ -0,0 +1,209 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace SimpleMatchingEngine::Metrics {
+    // Stages of MatchingEngine::process. MATCH includes formatting the fills it produces,
+    // which are only counted: a timer per fill costs more than the fill.
+    enum Stage
+    {
+        PARSE            = 0,
+        ORDER_MAP_INSERT = 1,
+        BOOK_INSERT      = 2,
+        MATCH            = 3,
+        STAGE_COUNT      = 4
+    };
+
+    enum Counter
+    {
+        MESSAGES         = 0,
+        FILLS            = 1,
+        LEVELS_CREATED   = 2,
+        LEVELS_DESTROYED = 3,
+        HASH_LOOKUPS     = 4,
+        COUNTER_COUNT    = 5
+    };
+
+    inline std::uint64_t read_tsc() noexcept
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    // Stage cycles and calls only cover the sampled messages, their ratio is the mean
+    struct Snapshot
+    {
+        std::array<std::uint64_t, STAGE_COUNT> stage_cycles{};
+        std::array<std::uint64_t, STAGE_COUNT> stage_calls{};
+        std::array<std::uint64_t, COUNTER_COUNT> counters{};
+        std::size_t threads = 0;
+    };
+
+    // Written by exactly one thread and read by any, so updates are a relaxed
+    // load and store rather than a locked read-modify-write.
+    class alignas(64) ThreadMetrics final
+    {
+    public:
+        // A TSC read costs about as much as a small stage, so only one message in
+        // SAMPLE_EVERY has its stages timed. Counters are exact.
+        static constexpr std::uint64_t SAMPLE_EVERY = 64;
+
+        void add(Counter counter, std::uint64_t n = 1) noexcept {
+            bump(counters_[counter], n);
+        }
+
+        void record(Stage stage, std::uint64_t cycles) noexcept {
+            bump(stage_cycles_[stage], cycles);
+            bump(stage_calls_[stage], 1);
+        }
+
+        // Counts a message and decides whether its stages are timed
+        void begin_message() noexcept {
+            timed_ = counters_[MESSAGES].load(std::memory_order_relaxed) % SAMPLE_EVERY == 0;
+            bump(counters_[MESSAGES], 1);
+        }
+
+        bool timed() const noexcept {
+            return timed_;
+        }
+
+        void accumulate(Snapshot &snapshot) const noexcept;
+
+    private:
+        static void bump(std::atomic<std::uint64_t> &value, std::uint64_t n) noexcept {
+            value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        }
+
+    private:
+        std::array<std::atomic<std::uint64_t>, STAGE_COUNT> stage_cycles_{};
+        std::array<std::atomic<std::uint64_t>, STAGE_COUNT> stage_calls_{};
+        std::array<std::atomic<std::uint64_t>, COUNTER_COUNT> counters_{};
+        bool timed_ = true; // only ever read by the owning thread
+    };
+
+    class Registry final
+    {
+    public:
+        static constexpr std::size_t MAX_THREADS = 64;
+
+        static Registry &instance() noexcept {
+            static Registry registry;
+            return registry;
+        }
+
+        Snapshot snapshot() const noexcept;
+
+        // Hands out the slot of a new thread, see local()
+        ThreadMetrics *claim() noexcept;
+
+    private:
+        std::array<ThreadMetrics, MAX_THREADS> slots_;
+        ThreadMetrics overflow_; // shared by threads past MAX_THREADS, never reported
+        std::atomic<std::size_t> used_{ 0 };
+    };
+
+    // Constant initialized, so reading it is a plain TLS load without an init guard
+    inline thread_local ThreadMetrics *local_metrics = nullptr;
+
+    // Each thread claims a slot the first time it records anything
+    inline ThreadMetrics &local() noexcept
+    {
+        if (local_metrics == nullptr) [[unlikely]]
+            local_metrics = Registry::instance().claim();
+
+        return *local_metrics;
+    }
+
+    // Zero when the current message is not sampled
+    inline std::uint64_t start_timer() noexcept
+    {
+        return local().timed() ? read_tsc() : 0;
+    }
+
+    inline void stop_timer(std::uint64_t start, Stage stage) noexcept
+    {
+        if (start != 0)
+            local_metrics->record(stage, read_tsc() - start);
+    }
+
+    class ScopedStage final
+    {
+    public:
+        explicit ScopedStage(Stage stage) noexcept
+            : stage_(stage), start_(start_timer())
+        {}
+
+        ~ScopedStage() {
+            stop_timer(start_, stage_);
+        }
+
+        ScopedStage(const ScopedStage &) = delete;
+        ScopedStage &operator=(const ScopedStage &) = delete;
+
+    private:
+        Stage stage_;
+        std::uint64_t start_;
+    };
+
+    void write(std::ostream &os, const Snapshot &snapshot);
+
+    // Appends a snapshot line to a file every interval until destroyed
+    class MetricsDumper final
+    {
+    public:
+        MetricsDumper(std::string path, std::chrono::milliseconds interval);
+        ~MetricsDumper();
+
+        MetricsDumper(const MetricsDumper &) = delete;
+        MetricsDumper &operator=(const MetricsDumper &) = delete;
+
+    private:
+        void run();
+
+    private:
+        std::string path_;
+        std::chrono::milliseconds interval_;
+        std::mutex mutex_;
+        std::condition_variable stop_cv_;
+        bool stop_;
+        std::thread thread_;
+    };
+}
+
+// Compiled out entirely unless SME_ENABLE_METRICS is defined
+#define SME_METRICS_CONCAT_IMPL(a, b) a##b
+#define SME_METRICS_CONCAT(a, b) SME_METRICS_CONCAT_IMPL(a, b)
+
+#ifdef SME_ENABLE_METRICS
+#define SME_METRICS_STAGE(stage) \
+    ::SimpleMatchingEngine::Metrics::ScopedStage SME_METRICS_CONCAT(sme_metrics_stage_, __LINE__)(stage)
+#define SME_METRICS_MESSAGE() \
+    ::SimpleMatchingEngine::Metrics::local().begin_message()
+#define SME_METRICS_TIMER(name) \
+    const std::uint64_t name = ::SimpleMatchingEngine::Metrics::start_timer()
+#define SME_METRICS_ELAPSED(name, stage) \
+    ::SimpleMatchingEngine::Metrics::stop_timer(name, stage)
+#define SME_METRICS_COUNT(counter, n) \
+    ::SimpleMatchingEngine::Metrics::local().add(counter, n)
+#else
+#define SME_METRICS_STAGE(stage) ((void)0)
+#define SME_METRICS_MESSAGE() ((void)0)
+#define SME_METRICS_TIMER(name) ((void)0)
+#define SME_METRICS_ELAPSED(name, stage) ((void)0)
+#define SME_METRICS_COUNT(counter, n) ((void)0)
+#endif
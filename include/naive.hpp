@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace SimpleMatchingEngine::Fuzz {
+    // The engine the optimized ones are diffed against. Written from the wire format rather than
+    // from BasicMatchingEngine and sharing none of its code: its own tokenizer, prices as plain
+    // integers of 1/10000, and every book side a plain vector of orders scanned front to back.
+    // Slow on purpose, the only thing it has to be is obviously right.
+    class NaiveEngine final
+    {
+    public:
+        using output_type = std::vector<std::string>;
+
+        void process(std::string_view wire, output_type &out);
+        std::vector<std::string> publish_books() const;
+
+    private:
+        enum class Kind { LIMIT, STOP_LOSS, STOP_LIMIT };
+
+        struct Order
+        {
+            std::int64_t id;
+            std::string symbol;
+            bool buy;
+            std::int64_t price;       // the limit, for a stop the one it gets once triggered
+            std::int64_t volume;
+            std::uint64_t sequence;   // higher is newer
+            std::int64_t stp_group;   // 0: no self trade prevention
+            std::string stp_mode;     // CN, CO, CB or DC
+            Kind kind;
+            std::int64_t trigger;
+        };
+
+        // Orders live in the vector of where they are, in arrival order: the first one at the
+        // best price trades first
+        struct Book
+        {
+            std::string symbol;
+            bool auction = false;
+            std::vector<Order> bids;
+            std::vector<Order> asks;
+            std::vector<Order> stops;
+            // Stops a trade reached, until they are activated
+            std::vector<Order> triggered;
+        };
+
+        struct Clearing
+        {
+            std::int64_t price = 0;
+            std::int64_t volume = 0;
+            std::int64_t imbalance = 0;
+        };
+
+        // Index of the reject name, 0 when accepted
+        int dispatch(const std::vector<std::string_view> &fields, output_type &out);
+        int insert(const std::vector<std::string_view> &fields, output_type &out);
+        int amend(const std::vector<std::string_view> &fields, output_type &out);
+        int pull(std::int64_t id);
+        int stop(const std::vector<std::string_view> &fields);
+        int auction(const std::vector<std::string_view> &fields);
+        int uncross(const std::vector<std::string_view> &fields, output_type &out);
+
+        Order *find_order(std::int64_t id);
+        Order *find_order(Book &book, std::int64_t id);
+        Book *find_book(std::string_view symbol);
+        Book &book_for(std::string_view symbol);
+        std::vector<Order> &side_of(Book &book, bool buy);
+        const Order *best(Book &book, bool buy);
+        Order forget(Book &book, std::int64_t id);
+
+        void match(Book &book, output_type &out);
+        void fill(Book &book, std::int64_t bid_id, std::int64_t ask_id, std::int64_t price, output_type &out);
+        void prevent_self_trade(Book &book, std::int64_t bid_id, std::int64_t ask_id, output_type &out);
+        void take(Book &book, std::int64_t id, std::int64_t volume);
+        void cancel(Book &book, std::int64_t id, std::int64_t volume, output_type &out);
+        void trigger_stops(Book &book, std::int64_t price);
+        void activate_stops(Book &book, output_type &out);
+        void activate_stop(Book &book, std::int64_t id, output_type &out);
+        Clearing clearing(Book &book);
+
+    private:
+        std::vector<Book> books_;
+        std::uint64_t sequence_ = 0;
+        bool activating_ = false;
+    };
+}
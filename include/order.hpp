@@ -1,25 +1,31 @@
 #pragma once
 #include "enums.hpp"
+#include "policies.hpp"
 #include "types.hpp"
-#include <memory>
+#include <ostream>
 #include <string>
-#include <vector>
 
 namespace SimpleMatchingEngine {
-    class Order final
+    template <typename Policy>
+    requires PricePolicy<typename Policy::price_policy>
+    class BasicOrder final
     {
     public:
-        static Order insert(const std::vector<std::string> &tokens, TimeStampType timestamp);
-        static Order amend(const std::vector<std::string> &tokens, TimeStampType timestamp);
-        static Order pull(const std::vector<std::string> &tokens, TimeStampType timestamp);
-        Order(OrderIdType order_id, SymbolType symbol, Side side, PriceType price, VolumeType volume, TimeStampType timestamp);
+        using price_policy = typename Policy::price_policy;
+        using price_type = typename price_policy::value_type;
+
+        // symbol must outlive the order: the engine passes the key of the symbol's orderbook.
+        // For a stop, price is the limit once triggered (unused for a plain stop).
+        BasicOrder(OrderIdType order_id, SymbolType symbol, Side side, price_type price, VolumeType volume, SequenceType sequence,
+                   StpGroupType stp_group = 0, SelfTradePrevention stp_mode = SelfTradePrevention::DISABLED,
+                   OrderType type = OrderType::LIMIT, price_type trigger_price = price_type{});
 
         OrderIdType get_order_id() const noexcept {
             return order_id_;
         }
 
         SymbolType get_symbol() const noexcept {
-            return symbol_;
+            return *symbol_;
         }
 
         Side get_side() const noexcept {
@@ -34,14 +40,18 @@ namespace SimpleMatchingEngine {
             return side_ == Side::SELL;
         }
 
-        PriceType get_price() const noexcept {
+        const price_type &get_price() const noexcept {
             return price_;
         }
 
-        void set_price(PriceType new_price) noexcept {
+        void set_price(const price_type &new_price) {
             price_ = new_price;
         }
 
+        void print_price(std::ostream &os) const {
+            price_policy::print(os, price_);
+        }
+
         VolumeType get_volume() const noexcept {
             return volume_;
         }
@@ -55,28 +65,76 @@ namespace SimpleMatchingEngine {
             volume_ -= other;
         }
 
-        void set_timestamp(TimeStampType new_timestamp) noexcept {
-            timestamp_ = new_timestamp;
+        SequenceType get_sequence() const noexcept {
+            return sequence_;
         }
 
-        bool is_aggressor(const Order &other) const noexcept {
-            if (timestamp_ > other.timestamp_)
+        void set_sequence(SequenceType new_sequence) noexcept {
+            sequence_ = new_sequence;
+        }
+
+        bool is_aggressor(const BasicOrder &other) const noexcept {
+            if (sequence_ > other.sequence_)
                 return true;
 
             return false;
         }
 
-    private:
-        static PriceType validate_price(const std::string &price);
-        static VolumeType validate_volume(const std::string &volume);
-        static Side side_from_string(const std::string &side);
+        OrderType get_type() const noexcept {
+            return type_;
+        }
+
+        // Still waiting in the trigger index rather than in the book
+        bool is_pending_stop() const noexcept {
+            return type_ != OrderType::LIMIT;
+        }
+
+        const price_type &get_trigger_price() const noexcept {
+            return trigger_price_;
+        }
+
+        // A triggered stop-limit becomes a plain limit order. A plain stop is priced by the book.
+        void trigger(const price_type &price) {
+            type_ = OrderType::LIMIT;
+            price_ = price;
+        }
+
+        StpGroupType get_stp_group() const noexcept {
+            return stp_group_;
+        }
+
+        SelfTradePrevention get_stp_mode() const noexcept {
+            return stp_mode_;
+        }
+
+        bool is_self_trade(const BasicOrder &other) const noexcept {
+            return stp_group_ != 0 && stp_group_ == other.stp_group_;
+        }
 
     private:
         OrderIdType order_id_;
-        Unqualified<SymbolType> symbol_;
+        const Unqualified<SymbolType> *symbol_;
         Side side_;
-        Unqualified<PriceType> price_;
+        price_type price_;
         VolumeType volume_;
-        TimeStampType timestamp_;
+        SequenceType sequence_;
+        StpGroupType stp_group_;
+        SelfTradePrevention stp_mode_;
+        OrderType type_;
+        price_type trigger_price_;
     };
+
+    template <typename Policy>
+    requires PricePolicy<typename Policy::price_policy>
+    BasicOrder<Policy>::BasicOrder(OrderIdType order_id, SymbolType symbol, Side side, price_type price, VolumeType volume, SequenceType sequence,
+                                   StpGroupType stp_group, SelfTradePrevention stp_mode, OrderType type, price_type trigger_price)
+        : order_id_(order_id), symbol_(&symbol), side_(side), price_(std::move(price)), volume_(volume), sequence_(sequence),
+          stp_group_(stp_group), stp_mode_(stp_mode), type_(type), trigger_price_(std::move(trigger_price))
+    {}
+
+    extern template class BasicOrder<ReferencePolicy>;
+    extern template class BasicOrder<FlatBookPolicy>;
+    extern template class BasicOrder<DefaultPolicy>;
+
+    using Order = BasicOrder<DefaultPolicy>;
 }
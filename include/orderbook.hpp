@@ -1,64 +1,563 @@
 #pragma once
+#include "market_data.hpp"
+#include "metrics.hpp"
 #include "order.hpp"
+#include "policies.hpp"
 #include "types.hpp"
 #include <algorithm>
-#include <map>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
 #include <memory>
+#include <ranges>
 #include <sstream>
+#include <stdexcept>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 namespace SimpleMatchingEngine {
-    class Orderbook final
+    // Where the book would uncross right now. imbalance > 0 is buy volume left over at that price.
+    template <typename Price>
+    struct IndicativeUncross
+    {
+        Price price{};
+        std::int64_t volume = 0;
+        std::int64_t imbalance = 0;
+    };
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    class BasicOrderbook final
     {
         public:
-            Orderbook(OrdersMapType *orders_by_id_, std::vector<std::string> &trades);
+            using order_type = BasicOrder<Policy>;
+            using price_type = typename order_type::price_type;
+            using order_store_type = typename Policy::order_store_policy::template type<order_type>;
+            using event_sink = typename Policy::event_sink;
+            using output_type = typename event_sink::output_type;
+
+            BasicOrderbook(order_store_type *orders_by_id_, SequenceType *sequence);
 
-            void process_insert_order(const Order &order);
-            void process_amend_order(const Order &order);
-            void process_pull_order(const Order &order);
-            void uncross_book() noexcept;
+            // Trades and cancels go to the output of the message being processed
+            void process_insert_order(const order_type &order, output_type &trades);
+            void process_stop_order(const order_type &order);
+            void process_amend_order(order_type &order, VolumeType new_volume, output_type &trades);
+            void process_pull_order(const order_type &order);
+            void uncross_book(output_type &trades) noexcept;
+
+            // Orders rest without matching until the auction is uncrossed
+            void start_auction() noexcept;
+            void uncross_auction(output_type &trades) noexcept;
+            IndicativeUncross<price_type> indicative_uncross() const noexcept;
+
+            bool in_auction() const noexcept {
+                return in_auction_;
+            }
 
             std::vector<std::string> print_levels() const noexcept;
+            void snapshot_depth(MarketData::BookDepth &depth, std::uint32_t max_depth) const noexcept;
+
+            int get_market_data_slot() const noexcept {
+                return market_data_slot_;
+            }
+
+            void set_market_data_slot(int slot) noexcept {
+                market_data_slot_ = slot;
+            }
 
         private:
+            // The price is the key the order rests under: its limit in the book, its trigger in the stop index
             template <typename BookSideType>
-            void insert_order(const Order &order, BookSideType &book_side)
+            void insert_order(const order_type &order, const price_type &price, BookSideType &book_side)
             {
-                const auto order_id = order.get_order_id();
+                auto inserted = book_side.emplace(price, PriceLevel{});
+                if (inserted.second)
+                    SME_METRICS_COUNT(Metrics::Counter::LEVELS_CREATED, 1);
 
-                std::vector<OrderIdType> orders{ order_id };
-                auto inserted = book_side.emplace(std::make_pair(order.get_price(), orders));
-                if (inserted.second == false) {
-                    auto &orders = inserted.first->second;
-                    orders.push_back(order_id);
-                }
+                auto &level = inserted.first->second;
+                level.orders.push_back(order.get_order_id());
+                level.volume += order.get_volume();
             }
 
             template <typename BookSideType>
-            void pull_order(const Order &order, BookSideType &book_side)
+            void pull_order(const order_type &order, const price_type &price, BookSideType &book_side)
             {
-                auto level_iter = book_side.find(order.get_price());
+                auto level_iter = book_side.find(price);
                 if (level_iter == book_side.end())
                     return;
 
-                auto &orders = level_iter->second;
-                auto order_iter = std::find(orders.begin(), orders.end(), order.get_order_id());
-                orders.erase(order_iter);
+                auto &level = level_iter->second;
+                auto order_iter = std::find(level.orders.begin(), level.orders.end(), order.get_order_id());
+                level.orders.erase(order_iter);
+                level.volume -= order.get_volume();
 
-                if (level_iter->second.empty())
+                if (level.orders.empty()) {
+                    SME_METRICS_COUNT(Metrics::Counter::LEVELS_DESTROYED, 1);
                     level_iter = book_side.erase(level_iter);
+                }
+            }
+
+            // Best to worst, wherever the level policy keeps the best level
+            template <typename BookSideType>
+            static auto best_first(BookSideType &book_side) noexcept
+            {
+                if constexpr (Policy::level_policy::best_at_back)
+                    return std::ranges::subrange(book_side.rbegin(), book_side.rend());
+                else
+                    return std::ranges::subrange(book_side.begin(), book_side.end());
+            }
+
+            template <typename BookSideType>
+            void reduce_best_order(order_type &order, VolumeType volume, BookSideType &book_side) noexcept
+            {
+                // The order at the front of the best level is the one being matched
+                auto &level = best_first(book_side).begin()->second;
+                order.reduce_volume(volume);
+                level.volume -= volume;
+
+                if (order.get_volume() != 0)
+                    return;
+
+                // Fully filled or cancelled: it leaves the book and the pool of orders
+                orders_by_id_->erase(level.orders.front());
+                level.orders.erase(level.orders.begin());
+
+                if (level.orders.empty()) {
+                    SME_METRICS_COUNT(Metrics::Counter::LEVELS_DESTROYED, 1);
+                    book_side.erase(Policy::level_policy::best_at_back ? std::prev(book_side.end()) : book_side.begin());
+                }
+            }
+
+            template <typename BookSideType>
+            static std::uint32_t snapshot_side(const BookSideType &book_side, MarketData::Level *levels, std::uint32_t max_depth) noexcept
+            {
+                std::uint32_t count = 0;
+                const auto levels_best_first = best_first(book_side);
+                for (auto level_iter = levels_best_first.begin(); level_iter != levels_best_first.end() && count < max_depth; ++level_iter, ++count)
+                    levels[count] = { Policy::price_policy::to_ticks(level_iter->first), level_iter->second.volume };
+
+                return count;
+            }
+
+            template <typename StopSideType>
+            void collect_triggered_stops(const price_type &price, StopSideType &stop_side)
+            {
+                // Sorted so the stops a trade reaches are always at the front: the rest are never looked at
+                const auto triggered_end = stop_side.upper_bound(price);
+                for (auto level_iter = stop_side.begin(); level_iter != triggered_end; ++level_iter) {
+                    for (auto order_id : level_iter->second.orders)
+                        triggered_stops_.emplace_back(get_order(order_id).get_sequence(), order_id);
+                }
+
+                stop_side.erase(stop_side.begin(), triggered_end);
             }
 
-            Order &get_order(OrderIdType order_id) const;
-            static std::string publish_trade(const Order &bid, const Order &ask);
+            void activate_stops(output_type &trades) noexcept;
+            void activate_stop(order_type &order, output_type &trades) noexcept;
+
+            // Stops only trigger while trading, inside the MATCH stage of the trade that reached
+            // them: going through process_insert_order would time that match a second time
+            void enter_triggered_stop(const order_type &order, output_type &trades) noexcept {
+                order.is_buy() ? insert_order(order, order.get_price(), bids_) : insert_order(order, order.get_price(), asks_);
+                uncross_book(trades);
+            }
+
+            void execute_order(order_type &order, VolumeType volume) noexcept;
+            void cancel_order(order_type &order, VolumeType volume, output_type &trades) noexcept;
+            void prevent_self_trade(order_type &bid, order_type &ask, output_type &trades) noexcept;
+
+            order_type &get_order(OrderIdType order_id) const noexcept;
+            void match_orders(order_type &bid, order_type &ask, const price_type &price, output_type &trades) noexcept;
+            void publish_trade(const order_type &bid, const order_type &ask, const price_type &price, output_type &trades);
 
         private:
-            // Using ordered maps as I will need to be able to iterate in order
-            std::map<Unqualified<PriceType>, std::vector<OrderIdType>, std::greater<PriceType>> bids_;
-            std::map<Unqualified<PriceType>, std::vector<OrderIdType>> asks_;
-            OrdersMapType *orders_by_id_;
-            std::vector<std::string> &trades_;
+            // Ordered containers as I will need to be able to iterate in order
+            typename Policy::level_policy::template type<price_type, std::greater<price_type>> bids_;
+            typename Policy::level_policy::template type<price_type, std::less<price_type>> asks_;
+            // Pending stops by trigger price. Buy stops trigger at or above it, sell stops at or below.
+            // Always node based whatever the book levels are: triggered levels leave from the front.
+            MapLevels::type<price_type, std::less<price_type>> buy_stops_;
+            MapLevels::type<price_type, std::greater<price_type>> sell_stops_;
+            // Sequence and id of the stops the current uncross triggered, kept around to avoid allocating
+            std::vector<std::pair<SequenceType, OrderIdType>> triggered_stops_;
+            std::vector<std::pair<SequenceType, OrderIdType>> activating_stops_;
+            order_store_type *orders_by_id_;
+            SequenceType *sequence_;
+            int market_data_slot_;
+            bool in_auction_;
+            bool activating_;
     };
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    BasicOrderbook<Policy>::BasicOrderbook(order_store_type *orders_by_id_, SequenceType *sequence)
+      : orders_by_id_(orders_by_id_), sequence_(sequence), market_data_slot_(-1), in_auction_(false), activating_(false)
+    {
+        if (!orders_by_id_)
+            throw std::runtime_error("orders_by_id_ cannot be nullptr");
+
+        if (!sequence_)
+            throw std::runtime_error("sequence cannot be nullptr");
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicOrderbook<Policy>::process_insert_order(const order_type &order, output_type &trades)
+    {
+        {
+            SME_METRICS_STAGE(Metrics::Stage::BOOK_INSERT);
+            order.is_buy() ? insert_order(order, order.get_price(), bids_) : insert_order(order, order.get_price(), asks_);
+        }
+
+        if (in_auction_)
+            return;
+
+        SME_METRICS_STAGE(Metrics::Stage::MATCH);
+        uncross_book(trades);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicOrderbook<Policy>::process_stop_order(const order_type &order)
+    {
+        // Only trades trigger stops, so the book has nothing to uncross
+        const auto &trigger_price = order.get_trigger_price();
+        order.is_buy() ? insert_order(order, trigger_price, buy_stops_) : insert_order(order, trigger_price, sell_stops_);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicOrderbook<Policy>::process_amend_order(order_type &order, VolumeType new_volume, output_type &trades)
+    {
+        // Only called when the order keeps its priority: same price and no more volume
+        auto &level = order.is_buy() ? bids_.find(order.get_price())->second : asks_.find(order.get_price())->second;
+        level.volume -= order.get_volume() - new_volume;
+        order.set_volume(new_volume);
+
+        if (in_auction_)
+            return;
+
+        SME_METRICS_STAGE(Metrics::Stage::MATCH);
+        uncross_book(trades);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicOrderbook<Policy>::process_pull_order(const order_type &order)
+    {
+        if (order.is_pending_stop()) {
+            const auto &trigger_price = order.get_trigger_price();
+            order.is_buy() ? pull_order(order, trigger_price, buy_stops_) : pull_order(order, trigger_price, sell_stops_);
+            return;
+        }
+
+        order.is_buy() ? pull_order(order, order.get_price(), bids_) : pull_order(order, order.get_price(), asks_);
+        // No need to uncross the book when pulling an order
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    std::vector<std::string> BasicOrderbook<Policy>::print_levels() const noexcept {
+        std::vector<std::string> ret;
+
+        const auto bids = best_first(bids_);
+        const auto asks = best_first(asks_);
+        for (auto bid_iter = bids.begin(), ask_iter = asks.begin(); bid_iter != bids.end() || ask_iter != asks.end(); ) {
+            std::ostringstream oss;
+
+            if (bid_iter != bids.end()) {
+                Policy::price_policy::print(oss, bid_iter->first);
+                oss << "," << bid_iter->second.volume;
+                bid_iter = std::next(bid_iter);
+            } else {
+                oss << ",";
+            }
+
+            oss << ",";
+
+            if (ask_iter != asks.end()) {
+                Policy::price_policy::print(oss, ask_iter->first);
+                oss << "," << ask_iter->second.volume;
+                ask_iter = std::next(ask_iter);
+            } else {
+                oss << ",";
+            }
+
+            ret.push_back(oss.str());
+        }
+
+        return ret;
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicOrderbook<Policy>::snapshot_depth(MarketData::BookDepth &depth, std::uint32_t max_depth) const noexcept
+    {
+        max_depth = std::min<std::uint32_t>(max_depth, MarketData::MAX_DEPTH);
+        depth.bid_depth = snapshot_side(bids_, depth.bids, max_depth);
+        depth.ask_depth = snapshot_side(asks_, depth.asks, max_depth);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicOrderbook<Policy>::uncross_book(output_type &trades) noexcept
+    {
+        // Need to check if price levels are crossed
+        while (!bids_.empty() && !asks_.empty()) {
+            auto bid_level = best_first(bids_).begin();
+            auto ask_level = best_first(asks_).begin();
+
+            if (bid_level->first < ask_level->first) {
+                // The book is now uncrossed
+                break;
+            }
+
+            // Time priority: the oldest order on each best level trades first
+            auto &bid_order = get_order(bid_level->second.orders.front());
+            auto &ask_order = get_order(ask_level->second.orders.front());
+
+            // Continuous trading happens at the price of the resting order
+            match_orders(bid_order, ask_order, bid_order.is_aggressor(ask_order) ? ask_order.get_price() : bid_order.get_price(), trades);
+        }
+
+        if (!triggered_stops_.empty()) [[unlikely]]
+            activate_stops(trades);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicOrderbook<Policy>::activate_stops(output_type &trades) noexcept
+    {
+        // Stops triggered by triggered stops are picked up by the outermost call
+        if (activating_)
+            return;
+
+        activating_ = true;
+        while (!triggered_stops_.empty()) {
+            // Stops reached by the same trades enter the book in the order they were sent
+            activating_stops_.swap(triggered_stops_);
+            std::sort(activating_stops_.begin(), activating_stops_.end());
+
+            for (const auto &[sequence, order_id] : activating_stops_)
+                activate_stop(get_order(order_id), trades);
+
+            activating_stops_.clear();
+        }
+
+        activating_ = false;
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicOrderbook<Policy>::activate_stop(order_type &order, output_type &trades) noexcept
+    {
+        // A triggered stop is newer than anything resting
+        order.set_sequence(++*sequence_);
+
+        if (order.get_type() == OrderType::STOP_LIMIT) {
+            order.trigger(order.get_price());
+            enter_triggered_stop(order, trades);
+            return;
+        }
+
+        // A plain stop takes whatever the other side has and never rests: what is left is cancelled
+        const auto order_id = order.get_order_id();
+        if (order.is_buy() ? asks_.empty() : bids_.empty()) {
+            event_sink::on_cancel(trades, order, order.get_volume());
+            orders_by_id_->erase(order_id);
+            return;
+        }
+
+        order.trigger(order.is_buy() ? std::prev(best_first(asks_).end())->first : std::prev(best_first(bids_).end())->first);
+        enter_triggered_stop(order, trades);
+
+        auto order_iter = orders_by_id_->find(order_id);
+        if (order_iter != orders_by_id_->end()) {
+            event_sink::on_cancel(trades, order_iter->second, order_iter->second.get_volume());
+            process_pull_order(order_iter->second);
+            orders_by_id_->erase(order_iter);
+        }
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicOrderbook<Policy>::start_auction() noexcept
+    {
+        in_auction_ = true;
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicOrderbook<Policy>::uncross_auction(output_type &trades) noexcept
+    {
+        in_auction_ = false;
+
+        // Everything that can trade at the clearing price does, all at that price
+        const auto uncross = indicative_uncross();
+        if (uncross.volume != 0) {
+            SME_METRICS_STAGE(Metrics::Stage::MATCH);
+            while (!bids_.empty() && !asks_.empty()) {
+                auto bid_level = best_first(bids_).begin();
+                auto ask_level = best_first(asks_).begin();
+                if (bid_level->first < uncross.price || uncross.price < ask_level->first)
+                    break;
+
+                match_orders(get_order(bid_level->second.orders.front()), get_order(ask_level->second.orders.front()), uncross.price, trades);
+            }
+        }
+
+        // STP can leave the book crossed, continuous trading takes it from there
+        uncross_book(trades);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    IndicativeUncross<typename BasicOrderbook<Policy>::price_type> BasicOrderbook<Policy>::indicative_uncross() const noexcept
+    {
+        IndicativeUncross<price_type> best;
+        const auto bids = best_first(bids_);
+        const auto asks = best_first(asks_);
+        if (bids.empty() || asks.empty() || bids.begin()->first < asks.begin()->first)
+            return best;
+
+        // Only the crossed levels can trade. Levels already hold their aggregated volume.
+        const auto &best_bid = bids.begin()->first;
+        const auto &best_ask = asks.begin()->first;
+
+        std::int64_t ask_volume = 0;
+        auto ask_iter = asks.begin();
+        for (; ask_iter != asks.end() && !(best_bid < ask_iter->first); ++ask_iter)
+            ask_volume += ask_iter->second.volume;
+
+        // One sweep down from the best bid: bids at or above the price accumulate,
+        // asks strictly above it drop out of the executable ask volume.
+        std::int64_t bid_volume = 0;
+        auto bid_iter = bids.begin();
+        while (ask_iter != asks.begin() || (bid_iter != bids.end() && !(bid_iter->first < best_ask))) {
+            const bool bid_candidate = bid_iter != bids.end() && !(bid_iter->first < best_ask);
+            const bool ask_candidate = ask_iter != asks.begin();
+            const auto &price = !ask_candidate || (bid_candidate && std::prev(ask_iter)->first < bid_iter->first)
+                ? bid_iter->first
+                : std::prev(ask_iter)->first;
+
+            if (bid_candidate && !(bid_iter->first < price)) {
+                bid_volume += bid_iter->second.volume;
+                ++bid_iter;
+            }
+
+            const auto volume = std::min(bid_volume, ask_volume);
+            const auto imbalance = bid_volume - ask_volume;
+
+            // Most volume, then least imbalance. Left over sell volume pushes the price down.
+            if (volume > best.volume
+                || (volume == best.volume && std::abs(imbalance) < std::abs(best.imbalance))
+                || (volume == best.volume && std::abs(imbalance) == std::abs(best.imbalance) && imbalance < 0))
+                best = { price, volume, imbalance };
+
+            if (ask_candidate && !(std::prev(ask_iter)->first < price)) {
+                --ask_iter;
+                ask_volume -= ask_iter->second.volume;
+            }
+        }
+
+        return best;
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicOrderbook<Policy>::match_orders(order_type &bid_order, order_type &ask_order, const price_type &price, output_type &trades) noexcept
+    {
+        // Both orders are already at hand, so STP costs a compare per fill
+        if (bid_order.is_self_trade(ask_order)) [[unlikely]] {
+            prevent_self_trade(bid_order, ask_order, trades);
+            return;
+        }
+
+        // Publish a trade
+        SME_METRICS_COUNT(Metrics::Counter::FILLS, 1);
+        publish_trade(bid_order, ask_order, price, trades);
+
+        // Any trade can reach pending stops, the tops of the indexes tell straight away
+        collect_triggered_stops(price, buy_stops_);
+        collect_triggered_stops(price, sell_stops_);
+
+        const auto volume = std::min(bid_order.get_volume(), ask_order.get_volume());
+        execute_order(bid_order, volume);
+        execute_order(ask_order, volume);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicOrderbook<Policy>::execute_order(order_type &order, VolumeType volume) noexcept
+    {
+        // Only ever called on the front order of the best level of its side
+        order.is_buy() ? reduce_best_order(order, volume, bids_) : reduce_best_order(order, volume, asks_);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicOrderbook<Policy>::cancel_order(order_type &order, VolumeType volume, output_type &trades) noexcept
+    {
+        // Reported before the volume goes, the order may leave the pool with it
+        event_sink::on_cancel(trades, order, volume);
+        execute_order(order, volume);
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicOrderbook<Policy>::prevent_self_trade(order_type &bid, order_type &ask, output_type &trades) noexcept
+    {
+        auto &aggressor = bid.is_aggressor(ask) ? bid : ask;
+        auto &passive = bid.is_aggressor(ask) ? ask : bid;
+
+        switch (aggressor.get_stp_mode()) {
+            case SelfTradePrevention::CANCEL_OLDEST:
+                cancel_order(passive, passive.get_volume(), trades);
+                break;
+            case SelfTradePrevention::CANCEL_BOTH:
+                cancel_order(passive, passive.get_volume(), trades);
+                cancel_order(aggressor, aggressor.get_volume(), trades);
+                break;
+            case SelfTradePrevention::DECREMENT_AND_CANCEL:
+            {
+                // Both sides lose the overlapping volume, no trade is printed
+                const auto volume = std::min(bid.get_volume(), ask.get_volume());
+                cancel_order(passive, volume, trades);
+                cancel_order(aggressor, volume, trades);
+                break;
+            }
+            case SelfTradePrevention::CANCEL_NEWEST:
+            default:
+                cancel_order(aggressor, aggressor.get_volume(), trades);
+                break;
+        }
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    typename BasicOrderbook<Policy>::order_type &BasicOrderbook<Policy>::get_order(OrderIdType order_id) const noexcept
+    {
+        SME_METRICS_COUNT(Metrics::Counter::HASH_LOOKUPS, 1);
+        auto order_iter = orders_by_id_->find(order_id);
+
+        // Every id resting in the book is in the pool of orders, it leaves the pool last
+        assert(order_iter != orders_by_id_->end());
+        return order_iter->second;
+    }
+
+    template <typename Policy>
+    requires EnginePolicy<Policy, BasicOrder<Policy>>
+    void BasicOrderbook<Policy>::publish_trade(const order_type &bid, const order_type &ask, const price_type &price, output_type &trades) {
+        const auto &aggressor = bid.is_aggressor(ask) ? bid : ask;
+        const auto &passive = bid.is_aggressor(ask) ? ask : bid;
+
+        event_sink::on_trade(trades, aggressor, passive, price, std::min(bid.get_volume(), ask.get_volume()));
+    }
+
+    extern template class BasicOrderbook<ReferencePolicy>;
+    extern template class BasicOrderbook<FlatBookPolicy>;
+    extern template class BasicOrderbook<DefaultPolicy>;
+
+    using Orderbook = BasicOrderbook<DefaultPolicy>;
 }
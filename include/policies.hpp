@@ -0,0 +1,343 @@
+#pragma once
+#include "enums.hpp"
+#include "types.hpp"
+#include <algorithm>
+#include <boost/container/flat_map.hpp>
+#include <charconv>
+#include <compare>
+#include <concepts>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace SimpleMatchingEngine {
+    // How a wire price is stored, ordered and printed back. parse returns nothing for an invalid price.
+    template <typename P>
+    concept PricePolicy = requires(std::string_view wire, std::ostream &os, const typename P::value_type &price) {
+        requires std::totally_ordered<typename P::value_type>;
+        requires std::default_initializable<typename P::value_type>;
+        { P::parse(wire) } -> std::same_as<std::optional<typename P::value_type>>;
+        { P::print(os, price) } -> std::same_as<void>;
+        { P::to_ticks(price) } -> std::same_as<std::int64_t>;
+    };
+
+    // Orders resting at one price in time priority, with their total volume kept up to date
+    struct PriceLevel
+    {
+        std::vector<OrderIdType> orders;
+        std::int64_t volume = 0; // a sum of VolumeType, wider so it cannot overflow
+    };
+
+    // One side of the book: price -> level, best level at one end, see LevelPolicy
+    template <typename C>
+    concept LevelContainer = requires(C c, const typename C::key_type &price, typename C::iterator iter) {
+        requires std::same_as<typename C::mapped_type, PriceLevel>;
+        // The auction walks the crossed levels of the ask side backwards, plain stops look up the worst level
+        requires std::bidirectional_iterator<typename C::iterator>;
+        requires std::bidirectional_iterator<typename C::const_iterator>;
+        c.key_comp();
+        { c.begin() } -> std::same_as<typename C::iterator>;
+        { c.end() } -> std::same_as<typename C::iterator>;
+        c.rbegin();
+        c.rend();
+        { c.find(price) } -> std::same_as<typename C::iterator>;
+        { c.emplace(price, typename C::mapped_type{}) } -> std::same_as<std::pair<typename C::iterator, bool>>;
+        { c.erase(iter) } -> std::same_as<typename C::iterator>;
+        { c.empty() } -> std::convertible_to<bool>;
+    };
+
+    // Both sides of the book. best_at_back: the container keeps the best level last rather than first.
+    template <typename L, typename Price>
+    concept LevelPolicy = requires {
+        { L::best_at_back } -> std::convertible_to<bool>;
+        requires LevelContainer<typename L::template type<Price, std::less<Price>>>;
+        requires LevelContainer<typename L::template type<Price, std::greater<Price>>>;
+    };
+
+    // Pool of live orders keyed by order id
+    template <typename S, typename OrderT>
+    concept OrderStore = requires(S s, OrderIdType order_id, const OrderT &order, typename S::iterator iter) {
+        { s.find(order_id) } -> std::same_as<typename S::iterator>;
+        { s.end() } -> std::same_as<typename S::iterator>;
+        { iter->second } -> std::convertible_to<const OrderT &>;
+        { s.try_emplace(order_id, order) } -> std::same_as<std::pair<typename S::iterator, bool>>;
+        s.erase(order_id);
+        s.erase(iter);
+    };
+
+    // Where trades, cancels and rejects go. The output object is owned by the caller of MatchingEngine::process
+    template <typename S, typename OrderT>
+    concept EventSink = requires(typename S::output_type &out, const OrderT &order, VolumeType volume, RejectCode code, OrderIdType order_id) {
+        { S::on_trade(out, order, order, order.get_price(), volume) } -> std::same_as<void>;
+        { S::on_cancel(out, order, volume) } -> std::same_as<void>;
+        { S::on_reject(out, code, order_id) } -> std::same_as<void>;
+    };
+
+    template <typename P, typename OrderT>
+    concept EnginePolicy =
+        PricePolicy<typename P::price_policy> &&
+        LevelPolicy<typename P::level_policy, typename P::price_policy::value_type> &&
+        OrderStore<typename P::order_store_policy::template type<OrderT>, OrderT> &&
+        EventSink<typename P::event_sink, OrderT>;
+
+    // Prices kept as the wire string and printed back verbatim, but ordered by value: "10" is
+    // above "9", and "12.2" and "12.20" are the same level, printed as its first order sent it
+    struct StringPrice
+    {
+        struct value_type
+        {
+            std::string text;
+            std::int64_t ticks = 0;
+
+            friend bool operator==(const value_type &lhs, const value_type &rhs) noexcept {
+                return lhs.ticks == rhs.ticks;
+            }
+
+            friend std::strong_ordering operator<=>(const value_type &lhs, const value_type &rhs) noexcept {
+                return lhs.ticks <=> rhs.ticks;
+            }
+        };
+
+        static std::optional<value_type> parse(std::string_view price);
+
+        static void print(std::ostream &os, const value_type &price) {
+            os << price.text;
+        }
+
+        static std::int64_t to_ticks(const value_type &price) noexcept {
+            return price.ticks;
+        }
+    };
+
+    // Prices kept as integer ticks of 1/10000, the finest precision the wire format accepts
+    struct FixedPointPrice
+    {
+        using value_type = std::int64_t;
+        static constexpr int DECIMALS = 4;
+        static constexpr value_type SCALE = 10000;
+        static constexpr int MAX_CHARS = 32;
+
+        static std::optional<value_type> parse(std::string_view price) noexcept {
+            const auto *first = price.data();
+            const auto *last = first + price.size();
+            const bool negative = first != last && *first == '-';
+
+            value_type units = 0;
+            auto [ptr, ec] = std::from_chars(first + negative, last, units);
+            if (ec != std::errc() || (ptr != last && *ptr != '.'))
+                return std::nullopt;
+
+            value_type fraction = 0;
+            int digits = 0;
+            if (ptr != last) {
+                for (++ptr; ptr != last; ++ptr, ++digits) {
+                    if (*ptr < '0' || *ptr > '9' || digits == DECIMALS)
+                        return std::nullopt;
+
+                    fraction = fraction * 10 + (*ptr - '0');
+                }
+            }
+
+            for (; digits < DECIMALS; ++digits)
+                fraction *= 10;
+
+            // Too large to be held in ticks: rejected rather than wrapped
+            if (units < 0 || units > (std::numeric_limits<value_type>::max() - fraction) / SCALE)
+                return std::nullopt;
+
+            const auto ticks = units * SCALE + fraction;
+            return negative ? -ticks : ticks;
+        }
+
+        static std::int64_t to_ticks(value_type price) noexcept {
+            return price;
+        }
+
+        // Shortest form: no trailing zeros and no trailing decimal point
+        static void print(std::ostream &os, value_type price) {
+            char buffer[MAX_CHARS];
+            os.write(buffer, format(buffer, price) - buffer);
+        }
+
+        // Writes at most MAX_CHARS characters, returns one past the last one written
+        static char *format(char *out, value_type price) noexcept {
+            if (price < 0) {
+                *out++ = '-';
+                price = -price;
+            }
+
+            out = std::to_chars(out, out + MAX_CHARS - 1, price / SCALE).ptr;
+
+            auto fraction = price % SCALE;
+            if (fraction == 0)
+                return out;
+
+            int count = DECIMALS;
+            while (fraction % 10 == 0) {
+                fraction /= 10;
+                --count;
+            }
+
+            *out++ = '.';
+            for (int i = count - 1; i >= 0; --i, fraction /= 10)
+                out[i] = static_cast<char>('0' + fraction % 10);
+
+            return out + count;
+        }
+    };
+
+    // Ordering needs the value: a price that has no ticks is invalid for this policy too
+    inline std::optional<StringPrice::value_type> StringPrice::parse(std::string_view price) {
+        const auto ticks = FixedPointPrice::parse(price);
+        if (!ticks)
+            return std::nullopt;
+
+        return value_type{ std::string(price), *ticks };
+    }
+
+    struct MapLevels
+    {
+        template <typename Price, typename Compare>
+        using type = std::map<Price, PriceLevel, Compare>;
+
+        static constexpr bool best_at_back = false;
+    };
+
+    // Contiguous levels: cheaper to walk, more expensive to create or remove a level.
+    // Sorted worst to best, so the level that fills and empties all the time is the last
+    // element and removing it shifts nothing.
+    struct FlatMapLevels
+    {
+        template <typename Price, typename Compare>
+        struct Reversed
+        {
+            bool operator()(const Price &lhs, const Price &rhs) const noexcept {
+                return Compare{}(rhs, lhs);
+            }
+        };
+
+        template <typename Price, typename Compare>
+        using type = boost::container::flat_map<Price, PriceLevel, Reversed<Price, Compare>>;
+
+        static constexpr bool best_at_back = true;
+    };
+
+    struct HashOrderStore
+    {
+        template <typename OrderT>
+        using type = std::unordered_map<OrderIdType, OrderT>;
+    };
+
+    // Trades as "symbol,price,volume,aggressor id,passive id" strings
+    struct StringTradeSink
+    {
+        using output_type = std::vector<std::string>;
+
+        template <typename OrderT>
+        static void on_trade(output_type &out, const OrderT &aggressor, const OrderT &passive, const typename OrderT::price_type &price, VolumeType volume) {
+            std::ostringstream oss;
+            oss << passive.get_symbol() << ",";
+            OrderT::price_policy::print(oss, price);
+            oss << "," << volume << "," << aggressor.get_order_id() << "," << passive.get_order_id();
+            out.push_back(oss.str());
+        }
+
+        // "CANCEL,order id,volume": the volume the engine took off the order, not what it has left
+        template <typename OrderT>
+        static void on_cancel(output_type &out, const OrderT &order, VolumeType volume) {
+            std::ostringstream oss;
+            oss << "CANCEL," << order.get_order_id() << "," << volume;
+            out.push_back(oss.str());
+        }
+
+        // "REJECT,code,order id". Rejects come from clients, so no stream is built for each one.
+        static void on_reject(output_type &out, RejectCode code, OrderIdType order_id) {
+            // The longest code is 18 characters and an id at most 20 digits
+            char buffer[64];
+            constexpr std::string_view prefix = "REJECT,";
+            const std::string_view name = reject_code_to_string(code);
+
+            auto *end = std::copy(prefix.begin(), prefix.end(), buffer);
+            end = std::copy(name.begin(), name.end(), end);
+            *end++ = ',';
+            end = std::to_chars(end, buffer + sizeof(buffer), order_id).ptr;
+            out.emplace_back(buffer, end);
+        }
+    };
+
+    template <typename Price>
+    struct BasicEvent
+    {
+        EventType type;
+        RejectCode reject_code;
+        OrderIdType order_id;         // aggressor for a trade, cancelled or rejected order otherwise
+        OrderIdType passive_order_id;
+        VolumeType volume;
+        Price price;
+        const std::string *symbol;    // owned by the engine, null for rejects
+    };
+
+    // Plain structs instead of strings: nothing is allocated once the caller's vector has grown
+    template <typename Price>
+    struct EventVectorSink
+    {
+        using output_type = std::vector<BasicEvent<Price>>;
+
+        template <typename OrderT>
+        static void on_trade(output_type &out, const OrderT &aggressor, const OrderT &passive, const typename OrderT::price_type &price, VolumeType volume) {
+            out.push_back({ EventType::TRADE, RejectCode::ACCEPTED, aggressor.get_order_id(), passive.get_order_id(), volume, price, &passive.get_symbol() });
+        }
+
+        template <typename OrderT>
+        static void on_cancel(output_type &out, const OrderT &order, VolumeType volume) {
+            out.push_back({ EventType::CANCEL, RejectCode::ACCEPTED, order.get_order_id(), 0, volume, order.get_price(), &order.get_symbol() });
+        }
+
+        static void on_reject(output_type &out, RejectCode code, OrderIdType order_id) {
+            out.push_back({ EventType::REJECT, code, order_id, 0, 0, Price{}, nullptr });
+        }
+    };
+
+    // Policy bundles. An engine is instantiated over exactly one of them.
+    struct ReferencePolicy
+    {
+        using price_policy = StringPrice;
+        using level_policy = MapLevels;
+        using order_store_policy = HashOrderStore;
+        using event_sink = StringTradeSink;
+    };
+
+    struct FlatBookPolicy
+    {
+        using price_policy = FixedPointPrice;
+        using level_policy = FlatMapLevels;
+        using order_store_policy = HashOrderStore;
+        using event_sink = StringTradeSink;
+    };
+
+    struct StructuredEventPolicy
+    {
+        using price_policy = FixedPointPrice;
+        using level_policy = MapLevels;
+        using order_store_policy = HashOrderStore;
+        using event_sink = EventVectorSink<FixedPointPrice::value_type>;
+    };
+
+    // Integer prices keep the hot path free of per message strings
+    struct DefaultPolicy
+    {
+        using price_policy = FixedPointPrice;
+        using level_policy = MapLevels;
+        using order_store_policy = HashOrderStore;
+        using event_sink = StringTradeSink;
+    };
+}
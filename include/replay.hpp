@@ -0,0 +1,101 @@
+#pragma once
+#include "types.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace SimpleMatchingEngine::Replay {
+    // Read-only mapping of a whole capture, advised for one sequential pass
+    class MappedFile final
+    {
+    public:
+        explicit MappedFile(const std::string &path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        const char *data() const noexcept {
+            return data_;
+        }
+
+        std::size_t size() const noexcept {
+            return size_;
+        }
+
+    private:
+        const char *data_;
+        std::size_t size_;
+    };
+
+    // Binary capture: BINARY_MAGIC followed by fixed size records
+    inline constexpr char BINARY_MAGIC[8] = { 'S', 'M', 'E', 'B', 'I', 'N', '0', '2' };
+    inline constexpr std::size_t SYMBOL_LENGTH = 8;
+
+    // A message with no record of its own, rejects from clients mostly: the record is
+    // followed by its volume bytes of the message as received
+    inline constexpr std::uint8_t RAW_RECORD = 0xff;
+
+    struct BinaryRecord
+    {
+        std::uint8_t command;   // Command, or RAW_RECORD
+        std::uint8_t side;      // Side, INSERT and STOP
+        std::uint8_t stp_mode;  // SelfTradePrevention, INSERT only
+        std::uint8_t type;      // OrderType, STOP only
+        std::int32_t order_id;
+        std::int64_t price;     // FixedPointPrice ticks, the trigger price for STOP
+        std::int32_t volume;    // RAW_RECORD: length of the message that follows
+        std::int32_t stp_group; // STOP: limit price - trigger price in ticks
+        char symbol[SYMBOL_LENGTH]; // NUL padded
+    };
+    static_assert(sizeof(BinaryRecord) == 32);
+
+    inline bool is_binary(const char *data, std::size_t size) noexcept
+    {
+        return size >= sizeof(BINARY_MAGIC) && std::memcmp(data, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0;
+    }
+
+    // Calls f(std::string_view) for every line, without the line terminator
+    template <typename F>
+    void for_each_line(const char *data, std::size_t size, F &&f)
+    {
+        const char *end = data + size;
+        while (data < end) {
+            const char *eol = static_cast<const char *>(std::memchr(data, '\n', end - data));
+            if (!eol)
+                eol = end;
+
+            std::size_t length = eol - data;
+            if (length > 0 && data[length - 1] == '\r')
+                --length;
+
+            f(std::string_view(data, length));
+            data = eol + 1;
+        }
+    }
+
+    // Empty when the message has no record of its own and has to be kept as a RAW_RECORD
+    std::optional<BinaryRecord> encode(std::string_view wire);
+    // Wire form of a record other than RAW_RECORD, for inspecting captures
+    void decode(const BinaryRecord &record, std::string &wire);
+    void convert_to_binary(const std::string &csv_path, const std::string &binary_path);
+
+    struct PartitionResult
+    {
+        std::string capture;
+        std::uint64_t messages = 0;
+        std::uint64_t trades = 0;
+        std::uint64_t rejects = 0;
+        std::uint64_t cancels = 0;  // STP and plain stops
+        std::uint64_t mismatches = 0;
+        std::string first_mismatch;
+        double seconds = 0;
+    };
+
+    // Replays one capture through its own engine. With an empty golden path
+    // the trades are only counted; with record set they are written to it.
+    PartitionResult replay_partition(const std::string &capture, const std::string &golden, bool record);
+}
@@ -1,31 +1,17 @@
 #pragma once
-#include <chrono>
-#include <concepts>
+#include <cstdint>
 #include <string>
-#include <unordered_map>
+#include <type_traits>
 
 namespace SimpleMatchingEngine {
-    class Order;
-
     template<typename T>
     using Unqualified = typename std::remove_cv<typename std::remove_reference<T>::type>::type;
 
     using OrderIdType = int;
-    using PriceType = const std::string &; // you can change this to "double" if required
     using SymbolType = const std::string &;
-    using TimeStampType = std::chrono::time_point<std::chrono::steady_clock>;
+    using SequenceType = std::uint64_t; // Orders entering the book later get a higher sequence
     using VolumeType = int;
+    using StpGroupType = int; // 0 means the order does not take part in self-trade prevention
 
-    using OrdersMapType = std::unordered_map<OrderIdType, Order>;
-
-    template <typename T>
-    const std::string &convert_price(const std::string &price) {
-        return price;
-    }
-
-    template <typename T>
-    requires std::floating_point<T>
-    double convert_price(const std::string &price) {
-        return std::stod(price);
-    }
+    // Prices are a policy, see PricePolicy in policies.hpp
 }
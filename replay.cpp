@@ -0,0 +1,117 @@
+#include "replay.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace SimpleMatchingEngine;
+
+namespace {
+    void usage()
+    {
+        std::cerr << "usage: replay [--golden FILE | --golden-suffix SUFFIX] [--record] [--jobs N] CAPTURE..." << std::endl
+                  << "       replay --to-binary CSV BINARY" << std::endl
+                  << std::endl
+                  << "Each capture (CSV or binary) is an independent symbol partition replayed through its own engine." << std::endl
+                  << "  --golden FILE          expected trades for a single capture" << std::endl
+                  << "  --golden-suffix SUFFIX expected trades for every capture are in CAPTURE + SUFFIX" << std::endl
+                  << "  --record               write the trades to the golden files instead of verifying them" << std::endl
+                  << "  --jobs N               partitions replayed in parallel (default: hardware threads)" << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<std::string> captures;
+    std::string golden;
+    std::string golden_suffix;
+    bool record = false;
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+
+        if (arg == "--to-binary" && i + 2 < argc) {
+            Replay::convert_to_binary(argv[i + 1], argv[i + 2]);
+            return EXIT_SUCCESS;
+        } else if (arg == "--golden" && i + 1 < argc) {
+            golden = argv[++i];
+        } else if (arg == "--golden-suffix" && i + 1 < argc) {
+            golden_suffix = argv[++i];
+        } else if (arg == "--record") {
+            record = true;
+        } else if (arg == "--jobs" && i + 1 < argc) {
+            jobs = std::max(1, std::atoi(argv[++i]));
+        } else if (!arg.empty() && arg.front() == '-') {
+            usage();
+            return EXIT_FAILURE;
+        } else {
+            captures.push_back(arg);
+        }
+    }
+
+    if (captures.empty() || (!golden.empty() && captures.size() != 1)) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Replay::PartitionResult> results(captures.size());
+    std::atomic<std::size_t> next{ 0 };
+    std::atomic<bool> failed{ false };
+
+    auto worker = [&]() {
+        for (auto index = next++; index < captures.size(); index = next++) {
+            const auto &capture = captures[index];
+            const auto &golden_path = golden_suffix.empty() ? golden : capture + golden_suffix;
+
+            try {
+                results[index] = Replay::replay_partition(capture, golden_path, record);
+            } catch (const std::exception &e) {
+                std::cerr << capture << ": " << e.what() << std::endl;
+                results[index].capture = capture;
+                failed = true;
+            }
+        }
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < std::min<std::size_t>(jobs, captures.size()); ++i)
+        threads.emplace_back(worker);
+
+    for (auto &thread : threads)
+        thread.join();
+
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::uint64_t messages = 0;
+    std::uint64_t trades = 0;
+    for (const auto &result : results) {
+        messages += result.messages;
+        trades += result.trades;
+
+        std::cout << result.capture << ": " << result.messages << " messages, " << result.trades << " trades, "
+                  << result.cancels << " cancels, " << result.rejects << " rejects, " << std::fixed << std::setprecision(3) << result.seconds << "s";
+        if (result.seconds > 0)
+            std::cout << ", " << std::setprecision(0) << result.messages / result.seconds << " msg/s";
+        std::cout << std::endl;
+
+        if (result.mismatches != 0) {
+            std::cout << "  " << result.mismatches << " mismatches, first at " << result.first_mismatch << std::endl;
+            failed = true;
+        }
+    }
+
+    std::cout << "total: " << messages << " messages, " << trades << " trades in " << std::setprecision(3) << seconds << "s";
+    if (seconds > 0)
+        std::cout << ", " << std::setprecision(0) << messages / seconds << " msg/s";
+    std::cout << std::endl;
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
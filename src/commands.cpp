@@ -0,0 +1,118 @@
+#include "commands.hpp"
+#include "enums.hpp"
+#include <charconv>
+
+namespace SimpleMatchingEngine {
+    namespace {
+        template <typename T>
+        std::optional<T> int_from_string(std::string_view text) noexcept
+        {
+            T value;
+            const auto *last = text.data() + text.size();
+            auto [ptr, ec] = std::from_chars(text.data(), last, value);
+            if (ec != std::errc() || ptr != last)
+                return std::nullopt;
+
+            return value;
+        }
+    }
+
+    Tokens tokenize(std::string_view wire) noexcept
+    {
+        Tokens tokens;
+
+        // Consecutive commas are collapsed, extra fields are ignored
+        std::size_t start = 0;
+        while (start <= wire.size() && tokens.count < Tokens::MAX_TOKENS) {
+            auto end = wire.find(',', start);
+            if (end == std::string_view::npos)
+                end = wire.size();
+
+            if (end != start)
+                tokens.items[tokens.count++] = wire.substr(start, end - start);
+
+            start = end + 1;
+        }
+
+        return tokens;
+    }
+
+    std::optional<Command> command_from_string(std::string_view cmd) noexcept
+    {
+        if (cmd == "INSERT")
+            return Command::INSERT;
+
+        if (cmd == "AMEND")
+            return Command::AMEND;
+
+        if (cmd == "PULL")
+            return Command::PULL;
+
+        if (cmd == "AUCTION")
+            return Command::AUCTION;
+
+        if (cmd == "UNCROSS")
+            return Command::UNCROSS;
+
+        if (cmd == "STOP")
+            return Command::STOP;
+
+        return std::nullopt;
+    }
+
+    std::optional<OrderIdType> order_id_from_string(std::string_view order_id) noexcept
+    {
+        return int_from_string<OrderIdType>(order_id);
+    }
+
+    std::optional<StpGroupType> stp_group_from_string(std::string_view stp_group) noexcept
+    {
+        return int_from_string<StpGroupType>(stp_group);
+    }
+
+    std::optional<VolumeType> validate_volume(std::string_view vol_string) noexcept
+    {
+        auto volume = int_from_string<VolumeType>(vol_string);
+        if (volume && *volume < 0) {
+            // Volume cannot be negative
+            return std::nullopt;
+        }
+
+        return volume;
+    }
+
+    std::optional<Side> side_from_string(std::string_view side) noexcept
+    {
+        if (side == "BUY")
+            return Side::BUY;
+
+        if (side == "SELL")
+            return Side::SELL;
+
+        return std::nullopt;
+    }
+
+    std::optional<SelfTradePrevention> stp_mode_from_string(std::string_view stp_mode) noexcept
+    {
+        if (stp_mode == "CN")
+            return SelfTradePrevention::CANCEL_NEWEST;
+
+        if (stp_mode == "CO")
+            return SelfTradePrevention::CANCEL_OLDEST;
+
+        if (stp_mode == "CB")
+            return SelfTradePrevention::CANCEL_BOTH;
+
+        if (stp_mode == "DC")
+            return SelfTradePrevention::DECREMENT_AND_CANCEL;
+
+        return std::nullopt;
+    }
+
+    bool validate_price_format(std::string_view price) noexcept
+    {
+        // At most 4 decimals
+        auto found = price.find_last_of(".");
+        return found == std::string_view::npos || price.substr(found + 1).size() <= 4;
+    }
+}
@@ -0,0 +1,253 @@
+#include "fuzz.hpp"
+#include "policies.hpp"
+#include <algorithm>
+#include <random>
+
+namespace SimpleMatchingEngine::Fuzz {
+    namespace {
+        constexpr std::int64_t SCALE = FixedPointPrice::SCALE;
+        constexpr const char *STP_CODES[] = { "CN", "CO", "CB", "DC" };
+
+        // Where a symbol's mid wanders and its tick size. Each range straddles a power of ten
+        // or zero, so the levels of one book have prices of different widths.
+        struct PriceRange
+        {
+            std::int64_t low;
+            std::int64_t high;
+            std::int64_t step;
+        };
+
+        constexpr PriceRange PRICE_RANGES[] = {
+            { 98 * SCALE / 10, 102 * SCALE / 10, SCALE / 100 },   // 9.8 to 10.2
+            { 995 * SCALE / 10, 1005 * SCALE / 10, SCALE / 20 },  // 99.5 to 100.5
+            { 9990 * SCALE, 10010 * SCALE, SCALE },               // 9990 to 10010
+            { -SCALE / 10, SCALE / 10, SCALE / 100 },             // -0.1 to 0.1
+            { 950, 1050, 5 },                                     // 0.095 to 0.105
+        };
+
+        class Generator final
+        {
+        public:
+            explicit Generator(const Options &options)
+                : rng_(options.seed), next_id_(1)
+            {
+                for (int i = 0; i < std::max(1, options.symbols); ++i) {
+                    const auto &range = PRICE_RANGES[below(std::size(PRICE_RANGES))];
+                    symbols_.push_back("SYM" + std::to_string(i));
+                    ranges_.push_back(range);
+                    mids_.push_back(range.low + price_in(0, (range.high - range.low) / range.step) * range.step);
+                    in_auction_.push_back(false);
+                }
+            }
+
+            std::string next()
+            {
+                const auto symbol = below(symbols_.size());
+                drift(symbol);
+
+                const auto roll = below(100);
+                if (roll < 50)
+                    return insert(symbol, next_id_++);
+                if (roll < 66)
+                    return amend(symbol);
+                if (roll < 78)
+                    return "PULL," + std::to_string(known_id());
+                if (roll < 88)
+                    return stop(symbol);
+                if (roll < 91)
+                    return phase(symbol);
+                if (roll < 94)
+                    return insert(symbol, known_id());
+                return reject();
+            }
+
+        private:
+            std::uint64_t below(std::uint64_t bound) {
+                // Not a distribution: their output differs between standard libraries
+                return rng_() % bound;
+            }
+
+            bool chance(int percent) {
+                return below(100) < static_cast<std::uint64_t>(percent);
+            }
+
+            std::int64_t price_in(std::int64_t low, std::int64_t high) {
+                return low + static_cast<std::int64_t>(below(high - low + 1));
+            }
+
+            void drift(std::size_t symbol) {
+                const auto &range = ranges_[symbol];
+                if (chance(10))
+                    mids_[symbol] = std::clamp(mids_[symbol] + (chance(50) ? range.step : -range.step), range.low, range.high);
+            }
+
+            // Mostly on the symbol's tick grid so levels fill up, sometimes down to the last decimal
+            std::string price(std::size_t symbol, int low_steps, int high_steps) {
+                const auto step = ranges_[symbol].step;
+                auto ticks = mids_[symbol] + price_in(low_steps, high_steps) * step;
+                if (chance(10))
+                    ticks += price_in(-step + 1, step - 1);
+
+                return spell(ticks);
+            }
+
+            // Usually the shortest form, sometimes one of the other spellings of the same price
+            std::string spell(std::int64_t ticks) {
+                char buffer[FixedPointPrice::MAX_CHARS];
+                std::string wire(buffer, FixedPointPrice::format(buffer, ticks));
+                if (!chance(15))
+                    return wire;
+
+                const auto dot = wire.find('.');
+                switch (below(3)) {
+                    case 0:
+                        // Trailing zeros, up to the four decimals allowed
+                        if (dot == std::string::npos)
+                            wire += '.';
+                        wire.append(below(FixedPointPrice::DECIMALS - (dot == std::string::npos ? 0 : wire.size() - dot - 1) + 1), '0');
+                        break;
+                    case 1:
+                        // Leading zeros
+                        wire.insert(ticks < 0 ? 1 : 0, 1 + below(2), '0');
+                        break;
+                    default:
+                        // A decimal point and nothing after it
+                        if (dot == std::string::npos)
+                            wire += '.';
+                        break;
+                }
+
+                return wire;
+            }
+
+            std::string side_price(std::size_t symbol, bool buy) {
+                // Each side reaches a few steps through the mid so inserts cross regularly
+                return buy ? price(symbol, -8, 3) : price(symbol, -3, 8);
+            }
+
+            std::string volume() {
+                return std::to_string(chance(2) ? 0 : 1 + below(chance(10) ? 200 : 20));
+            }
+
+            OrderIdType known_id() {
+                if (next_id_ == 1)
+                    return 1;
+
+                // Recent ids are the ones most likely to be live
+                const auto back = chance(80) ? below(std::min<OrderIdType>(next_id_ - 1, 30)) : below(next_id_ - 1);
+                return next_id_ - 1 - static_cast<OrderIdType>(back);
+            }
+
+            std::string insert(std::size_t symbol, OrderIdType order_id) {
+                const bool buy = chance(50);
+                auto wire = "INSERT," + std::to_string(order_id) + "," + symbols_[symbol] + (buy ? ",BUY," : ",SELL,")
+                    + side_price(symbol, buy) + "," + volume();
+
+                if (chance(8)) {
+                    wire += "," + std::to_string(1 + below(3));
+                    if (chance(75))
+                        wire += std::string(",") + STP_CODES[below(std::size(STP_CODES))];
+                }
+
+                return wire;
+            }
+
+            std::string amend(std::size_t symbol) {
+                // The symbol of the order is unknown here: a price from another symbol is just a far away price
+                const auto order_id = known_id();
+                const auto amended_volume = chance(10) ? std::string("0") : volume();
+                return "AMEND," + std::to_string(order_id) + "," + price(symbol, -4, 4) + "," + amended_volume;
+            }
+
+            std::string stop(std::size_t symbol) {
+                // Triggers sit a little beyond the mid so trades keep reaching them
+                const bool buy = chance(50);
+                last_stop_id_ = next_id_;
+                auto wire = "STOP," + std::to_string(next_id_++) + "," + symbols_[symbol] + (buy ? ",BUY," : ",SELL,")
+                    + (buy ? price(symbol, 0, 6) : price(symbol, -6, 0)) + "," + volume();
+
+                if (chance(60))
+                    wire += "," + side_price(symbol, buy);
+
+                return wire;
+            }
+
+            std::string phase(std::size_t symbol) {
+                // Now and then the wrong phase, to be rejected
+                const bool open = chance(90) ? !in_auction_[symbol] : in_auction_[symbol];
+                in_auction_[symbol] = open;
+                return (open ? "AUCTION," : "UNCROSS,") + symbols_[symbol];
+            }
+
+            std::string reject() {
+                static constexpr const char *REJECTS[] = {
+                    "INSERT,x,SYM0,BUY,100,1", "INSERT,1,SYM0,HOLD,100,1", "INSERT,1,SYM0,BUY,100.12345,1",
+                    "INSERT,1,SYM0,BUY,100,-1", "INSERT,1,SYM0,BUY,100,1,1,XX", "AMEND,1", "PULL", "CANCEL,1",
+                    "UNCROSS,NOPE", ""
+                };
+
+                // The id of a stop that is most likely still pending, for a symbol never seen before
+                if (last_stop_id_ != 0 && chance(10))
+                    return "INSERT," + std::to_string(last_stop_id_) + ",NEW" + std::to_string(new_symbols_++) + ",BUY,1,1";
+
+                return REJECTS[below(std::size(REJECTS))];
+            }
+
+        private:
+            std::mt19937_64 rng_;
+            OrderIdType next_id_;
+            OrderIdType last_stop_id_ = 0;
+            int new_symbols_ = 0;
+            std::vector<std::string> symbols_;
+            std::vector<PriceRange> ranges_;
+            std::vector<std::int64_t> mids_;
+            std::vector<bool> in_auction_;
+        };
+    }
+
+    std::vector<std::string> generate(const Options &options)
+    {
+        Generator generator(options);
+
+        std::vector<std::string> messages;
+        messages.reserve(options.messages);
+        for (std::size_t i = 0; i < options.messages; ++i)
+            messages.push_back(generator.next());
+
+        return messages;
+    }
+
+    std::vector<std::string> shrink(std::vector<std::string> messages, const std::function<bool(const std::vector<std::string> &)> &fails)
+    {
+        // Delta debugging: try to drop chunks, halving their size whenever nothing can go
+        std::size_t chunk = std::max<std::size_t>(messages.size() / 2, 1);
+        std::vector<std::string> candidate;
+
+        while (!messages.empty()) {
+            bool removed = false;
+
+            for (std::size_t start = 0; start < messages.size(); ) {
+                const auto end = std::min(start + chunk, messages.size());
+
+                candidate.clear();
+                candidate.insert(candidate.end(), messages.begin(), messages.begin() + start);
+                candidate.insert(candidate.end(), messages.begin() + end, messages.end());
+
+                if (fails(candidate)) {
+                    messages.swap(candidate);
+                    removed = true;
+                } else {
+                    start = end;
+                }
+            }
+
+            if (chunk == 1 && !removed)
+                break;
+
+            if (!removed)
+                chunk = std::max<std::size_t>(chunk / 2, 1);
+        }
+
+        return messages;
+    }
+}
@@ -0,0 +1,227 @@
+#include "market_data.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace SimpleMatchingEngine::MarketData {
+    namespace {
+        [[noreturn]] void throw_errno(const std::string &what, const std::string &name)
+        {
+            std::ostringstream oss;
+            oss << what << " " << name << ": " << std::strerror(errno);
+            throw std::runtime_error(oss.str());
+        }
+
+        std::size_t segment_size(std::uint32_t max_symbols) noexcept
+        {
+            return sizeof(BookSlot) + std::size_t(max_symbols) * sizeof(BookSlot);
+        }
+
+        bool same_symbol(const char *slot_symbol, std::string_view symbol) noexcept
+        {
+            return strnlen(slot_symbol, SYMBOL_LENGTH) == symbol.size() && std::memcmp(slot_symbol, symbol.data(), symbol.size()) == 0;
+        }
+    }
+
+    // The header gets a whole slot so every BookSlot stays on its own cache lines
+    static_assert(sizeof(Header) <= sizeof(BookSlot));
+
+    bool BookDepth::operator==(const BookDepth &other) const noexcept
+    {
+        return bid_depth == other.bid_depth && ask_depth == other.ask_depth
+            && std::equal(bids, bids + bid_depth, other.bids) && std::equal(asks, asks + ask_depth, other.asks);
+    }
+
+    ShmBookPublisher::ShmBookPublisher(const std::string &name, std::uint32_t max_symbols, std::uint32_t depth)
+        : name_(name), size_(segment_size(max_symbols)), fd_(-1), header_(nullptr), slots_(nullptr), published_(max_symbols)
+    {
+        if (max_symbols == 0 || depth == 0 || depth > MAX_DEPTH)
+            throw std::invalid_argument("Invalid market data segment dimensions");
+
+        // Only a segment nobody holds the lock of is stale. Unlinked while still locked so a
+        // concurrent publisher cannot find it stale too and unlink our new segment instead.
+        int existing = ::shm_open(name_.c_str(), O_RDONLY, 0);
+        if (existing >= 0) {
+            if (::flock(existing, LOCK_EX | LOCK_NB) != 0) {
+                ::close(existing);
+                throw std::runtime_error("Shared memory is in use by a live publisher: " + name_);
+            }
+
+            ::shm_unlink(name_.c_str());
+            ::close(existing);
+        }
+
+        // Never truncate a segment in place: readers still mapping a stale one keep their copy,
+        // and O_EXCL makes sure no other publisher grabbed the name in between
+        fd_ = ::shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd_ < 0)
+            throw_errno("Cannot create shared memory", name_);
+
+        // Between the create and the lock another publisher may have found the segment stale
+        // and replaced it: the name must still be ours once locked
+        struct stat created;
+        struct stat named;
+        int current = -1;
+        const bool owned = ::flock(fd_, LOCK_EX | LOCK_NB) == 0 && ::fstat(fd_, &created) == 0
+            && (current = ::shm_open(name_.c_str(), O_RDONLY, 0)) >= 0 && ::fstat(current, &named) == 0
+            && named.st_ino == created.st_ino;
+        if (current >= 0)
+            ::close(current);
+
+        if (!owned) {
+            ::close(fd_);
+            throw std::runtime_error("Shared memory was taken over by another publisher: " + name_);
+        }
+
+        if (::ftruncate(fd_, size_) != 0) {
+            ::close(fd_);
+            ::shm_unlink(name_.c_str());
+            throw_errno("Cannot size shared memory", name_);
+        }
+
+        void *mapped = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd_);
+            ::shm_unlink(name_.c_str());
+            throw_errno("Cannot map shared memory", name_);
+        }
+
+        // A new segment is zeroed: every sequence starts at 0
+        header_ = static_cast<Header *>(mapped);
+        slots_ = reinterpret_cast<BookSlot *>(static_cast<char *>(mapped) + sizeof(BookSlot));
+        header_->version = SEGMENT_VERSION;
+        header_->max_symbols = max_symbols;
+        header_->depth = depth;
+        header_->symbol_count.store(0, std::memory_order_relaxed);
+
+        // Readers check the magic last
+        std::atomic_thread_fence(std::memory_order_release);
+        header_->magic = SEGMENT_MAGIC;
+    }
+
+    ShmBookPublisher::~ShmBookPublisher()
+    {
+        ::munmap(header_, size_);
+
+        // Nobody can take a locked segment over, the check only guards against it being
+        // removed by hand and the name reused since
+        struct stat ours;
+        struct stat named;
+        int current = ::shm_open(name_.c_str(), O_RDONLY, 0);
+        if (current >= 0) {
+            if (::fstat(fd_, &ours) == 0 && ::fstat(current, &named) == 0 && named.st_ino == ours.st_ino)
+                ::shm_unlink(name_.c_str());
+            ::close(current);
+        }
+
+        // Dropping the lock last: the name is gone before anyone could find the segment stale
+        ::close(fd_);
+    }
+
+    int ShmBookPublisher::slot_for(std::string_view symbol) noexcept
+    {
+        const auto count = header_->symbol_count.load(std::memory_order_relaxed);
+        for (std::uint32_t slot = 0; slot < count; ++slot) {
+            if (same_symbol(slots_[slot].symbol, symbol))
+                return slot;
+        }
+
+        if (count == header_->max_symbols || symbol.size() > SYMBOL_LENGTH)
+            return -1;
+
+        std::memcpy(slots_[count].symbol, symbol.data(), symbol.size());
+        header_->symbol_count.store(count + 1, std::memory_order_release);
+        return count;
+    }
+
+    void ShmBookPublisher::publish(int slot, const BookDepth &depth) noexcept
+    {
+        // Most messages leave the top levels alone: don't make readers retry for nothing
+        auto &published = published_[slot];
+        if (published == depth)
+            return;
+
+        published = depth;
+
+        auto &book = slots_[slot];
+        const auto sequence = book.sequence.load(std::memory_order_relaxed);
+        book.sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        std::memcpy(&book.depth, &depth, sizeof(depth));
+
+        book.sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    ShmBookReader::ShmBookReader(const std::string &name)
+        : size_(0), header_(nullptr), slots_(nullptr)
+    {
+        int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0)
+            throw_errno("Cannot open shared memory", name);
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(BookSlot)) {
+            ::close(fd);
+            throw std::runtime_error("Not a market data segment: " + name);
+        }
+
+        size_ = static_cast<std::size_t>(st.st_size);
+        void *mapped = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+
+        if (mapped == MAP_FAILED)
+            throw_errno("Cannot map shared memory", name);
+
+        header_ = static_cast<const Header *>(mapped);
+        slots_ = reinterpret_cast<const BookSlot *>(static_cast<const char *>(mapped) + sizeof(BookSlot));
+
+        const bool valid = header_->magic == SEGMENT_MAGIC && header_->version == SEGMENT_VERSION && size_ >= segment_size(header_->max_symbols);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!valid) {
+            ::munmap(const_cast<Header *>(header_), size_);
+            throw std::runtime_error("Not a market data segment: " + name);
+        }
+    }
+
+    ShmBookReader::~ShmBookReader()
+    {
+        ::munmap(const_cast<Header *>(header_), size_);
+    }
+
+    int ShmBookReader::find(std::string_view symbol) const noexcept
+    {
+        const auto count = header_->symbol_count.load(std::memory_order_acquire);
+        for (std::uint32_t slot = 0; slot < count; ++slot) {
+            if (same_symbol(slots_[slot].symbol, symbol))
+                return slot;
+        }
+
+        return -1;
+    }
+
+    std::uint64_t ShmBookReader::read(int slot, BookDepth &depth) const noexcept
+    {
+        const auto &book = slots_[slot];
+
+        // Copy until the writer left the slot alone for the whole copy
+        while (true) {
+            const auto before = book.sequence.load(std::memory_order_acquire);
+            if (before & 1)
+                continue;
+
+            std::memcpy(&depth, &book.depth, sizeof(depth));
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if (book.sequence.load(std::memory_order_relaxed) == before)
+                return before / 2;
+        }
+    }
+}
@@ -0,0 +1,81 @@
+#include "metrics.hpp"
+#include <algorithm>
+#include <fstream>
+
+namespace SimpleMatchingEngine::Metrics {
+    void ThreadMetrics::accumulate(Snapshot &snapshot) const noexcept
+    {
+        for (std::size_t i = 0; i < STAGE_COUNT; ++i) {
+            snapshot.stage_cycles[i] += stage_cycles_[i].load(std::memory_order_relaxed);
+            snapshot.stage_calls[i] += stage_calls_[i].load(std::memory_order_relaxed);
+        }
+
+        for (std::size_t i = 0; i < COUNTER_COUNT; ++i)
+            snapshot.counters[i] += counters_[i].load(std::memory_order_relaxed);
+    }
+
+    Snapshot Registry::snapshot() const noexcept
+    {
+        Snapshot ret;
+        ret.threads = std::min(used_.load(std::memory_order_acquire), MAX_THREADS);
+
+        for (std::size_t i = 0; i < ret.threads; ++i)
+            slots_[i].accumulate(ret);
+
+        return ret;
+    }
+
+    ThreadMetrics *Registry::claim() noexcept
+    {
+        const auto index = used_.fetch_add(1, std::memory_order_acq_rel);
+        if (index >= MAX_THREADS) [[unlikely]]
+            return &overflow_;
+
+        return &slots_[index];
+    }
+
+    void write(std::ostream &os, const Snapshot &snapshot)
+    {
+        static constexpr const char *stage_names[STAGE_COUNT] = { "parse", "order_map_insert", "book_insert", "match" };
+        static constexpr const char *counter_names[COUNTER_COUNT] = { "messages", "fills", "levels_created", "levels_destroyed", "hash_lookups" };
+
+        os << "threads=" << snapshot.threads;
+
+        for (std::size_t i = 0; i < COUNTER_COUNT; ++i)
+            os << "," << counter_names[i] << "=" << snapshot.counters[i];
+
+        for (std::size_t i = 0; i < STAGE_COUNT; ++i)
+            os << "," << stage_names[i] << "_cycles=" << snapshot.stage_cycles[i]
+               << "," << stage_names[i] << "_calls=" << snapshot.stage_calls[i];
+
+        os << std::endl;
+    }
+
+    MetricsDumper::MetricsDumper(std::string path, std::chrono::milliseconds interval)
+        : path_(std::move(path)), interval_(interval), stop_(false)
+    {
+        thread_ = std::thread(&MetricsDumper::run, this);
+    }
+
+    MetricsDumper::~MetricsDumper()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+
+        stop_cv_.notify_one();
+        thread_.join();
+    }
+
+    void MetricsDumper::run()
+    {
+        std::ofstream out(path_, std::ios::app);
+        std::unique_lock<std::mutex> lock(mutex_);
+
+        while (!stop_) {
+            stop_cv_.wait_for(lock, interval_, [this] { return stop_; });
+            write(out, Registry::instance().snapshot());
+        }
+    }
+}
@@ -0,0 +1,627 @@
+#include "naive.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <utility>
+
+namespace SimpleMatchingEngine::Fuzz {
+    namespace {
+        constexpr std::int64_t TICKS_PER_UNIT = 10000;
+        constexpr std::size_t MAX_FIELDS = 8;
+
+        constexpr const char *REJECT_NAMES[] = { "ACCEPTED", "UNKNOWN_COMMAND", "MALFORMED_MESSAGE", "INVALID_ORDER_ID", "INVALID_SIDE",
+                                                 "INVALID_PRICE", "INVALID_VOLUME", "INVALID_STP", "UNKNOWN_ORDER", "DUPLICATE_ORDER_ID",
+                                                 "UNKNOWN_SYMBOL", "INVALID_PHASE", "PENDING_STOP" };
+        enum Reject { ACCEPTED, UNKNOWN_COMMAND, MALFORMED_MESSAGE, INVALID_ORDER_ID, INVALID_SIDE, INVALID_PRICE, INVALID_VOLUME,
+                      INVALID_STP, UNKNOWN_ORDER, DUPLICATE_ORDER_ID, UNKNOWN_SYMBOL, INVALID_PHASE, PENDING_STOP };
+
+        constexpr std::int64_t INT32_LOW = std::numeric_limits<std::int32_t>::min();
+        constexpr std::int64_t INT32_HIGH = std::numeric_limits<std::int32_t>::max();
+
+        // Empty fields do not count, fields past the eighth are dropped
+        std::vector<std::string_view> split(std::string_view wire)
+        {
+            std::vector<std::string_view> fields;
+            std::size_t begin = 0;
+            for (std::size_t i = 0; i <= wire.size(); ++i) {
+                if (i != wire.size() && wire[i] != ',')
+                    continue;
+
+                if (i > begin && fields.size() < MAX_FIELDS)
+                    fields.push_back(wire.substr(begin, i - begin));
+                begin = i + 1;
+            }
+
+            return fields;
+        }
+
+        std::string_view field(const std::vector<std::string_view> &fields, std::size_t index)
+        {
+            return index < fields.size() ? fields[index] : std::string_view();
+        }
+
+        bool all_digits(std::string_view text)
+        {
+            return std::all_of(text.begin(), text.end(), [](char c) { return c >= '0' && c <= '9'; });
+        }
+
+        // An optional '-' then decimal digits, within [low, high]
+        std::optional<std::int64_t> to_integer(std::string_view text, std::int64_t low, std::int64_t high)
+        {
+            const bool negative = !text.empty() && text.front() == '-';
+            if (negative)
+                text.remove_prefix(1);
+
+            if (text.empty() || !all_digits(text))
+                return std::nullopt;
+
+            std::int64_t magnitude = 0;
+            for (char c : text) {
+                magnitude = magnitude * 10 + (c - '0');
+                // Every range used here fits well within this
+                if (magnitude > (std::int64_t(1) << 40))
+                    return std::nullopt;
+            }
+
+            const auto value = negative ? -magnitude : magnitude;
+            if (value < low || value > high)
+                return std::nullopt;
+
+            return value;
+        }
+
+        // [-]digits[.[up to 4 digits]] as ticks of 1/10000
+        std::optional<std::int64_t> to_ticks(std::string_view text)
+        {
+            const bool negative = !text.empty() && text.front() == '-';
+            if (negative)
+                text.remove_prefix(1);
+
+            const auto dot = text.find('.');
+            const auto whole = text.substr(0, dot);
+            const auto fraction = dot == std::string_view::npos ? std::string_view() : text.substr(dot + 1);
+            if (whole.empty() || !all_digits(whole) || fraction.size() > 4 || !all_digits(fraction))
+                return std::nullopt;
+
+            std::int64_t fraction_ticks = 0;
+            for (std::size_t i = 0; i < 4; ++i)
+                fraction_ticks = fraction_ticks * 10 + (i < fraction.size() ? fraction[i] - '0' : 0);
+
+            std::int64_t units = 0;
+            for (char c : whole) {
+                if (units > (std::numeric_limits<std::int64_t>::max() - (c - '0')) / 10)
+                    return std::nullopt;
+                units = units * 10 + (c - '0');
+            }
+
+            if (units > (std::numeric_limits<std::int64_t>::max() - fraction_ticks) / TICKS_PER_UNIT)
+                return std::nullopt;
+
+            const auto ticks = units * TICKS_PER_UNIT + fraction_ticks;
+            return negative ? -ticks : ticks;
+        }
+
+        // Shortest decimal form: no trailing zeros, no trailing '.'
+        std::string price_text(std::int64_t ticks)
+        {
+            std::string text = ticks < 0 ? "-" : "";
+            const auto magnitude = ticks < 0 ? -ticks : ticks;
+            text += std::to_string(magnitude / TICKS_PER_UNIT);
+
+            auto fraction = std::to_string(TICKS_PER_UNIT + magnitude % TICKS_PER_UNIT).substr(1);
+            while (!fraction.empty() && fraction.back() == '0')
+                fraction.pop_back();
+
+            if (!fraction.empty())
+                text += "." + fraction;
+
+            return text;
+        }
+    }
+
+    void NaiveEngine::process(std::string_view wire, output_type &out)
+    {
+        const auto fields = split(wire);
+        const auto reject = dispatch(fields, out);
+        if (reject != ACCEPTED) {
+            const auto order_id = to_integer(field(fields, 1), INT32_LOW, INT32_HIGH).value_or(0);
+            out.push_back(std::string("REJECT,") + REJECT_NAMES[reject] + "," + std::to_string(order_id));
+        }
+
+        ++sequence_;
+    }
+
+    std::vector<std::string> NaiveEngine::publish_books() const
+    {
+        auto books = books_;
+        std::sort(books.begin(), books.end(), [](const Book &lhs, const Book &rhs) { return lhs.symbol < rhs.symbol; });
+
+        // Volume per price, best first
+        auto levels = [](const std::vector<Order> &side, bool buy) {
+            std::vector<std::pair<std::int64_t, std::int64_t>> levels;
+            for (const auto &order : side) {
+                auto level = std::find_if(levels.begin(), levels.end(), [&](const auto &l) { return l.first == order.price; });
+                if (level == levels.end())
+                    levels.emplace_back(order.price, order.volume);
+                else
+                    level->second += order.volume;
+            }
+
+            std::sort(levels.begin(), levels.end(), [&](const auto &lhs, const auto &rhs) { return buy ? lhs.first > rhs.first : lhs.first < rhs.first; });
+            return levels;
+        };
+
+        std::vector<std::string> lines;
+        for (const auto &book : books) {
+            lines.push_back("===" + book.symbol + "===");
+
+            const auto bids = levels(book.bids, true);
+            const auto asks = levels(book.asks, false);
+            for (std::size_t i = 0; i < std::max(bids.size(), asks.size()); ++i) {
+                std::string line = i < bids.size() ? price_text(bids[i].first) + "," + std::to_string(bids[i].second) : ",";
+                line += ",";
+                line += i < asks.size() ? price_text(asks[i].first) + "," + std::to_string(asks[i].second) : ",";
+                lines.push_back(line);
+            }
+        }
+
+        return lines;
+    }
+
+    int NaiveEngine::dispatch(const std::vector<std::string_view> &fields, output_type &out)
+    {
+        const auto command = field(fields, 0);
+        if (command == "INSERT")
+            return insert(fields, out);
+        if (command == "AMEND")
+            return amend(fields, out);
+        if (command == "PULL") {
+            if (fields.size() < 2)
+                return MALFORMED_MESSAGE;
+
+            const auto id = to_integer(fields[1], INT32_LOW, INT32_HIGH);
+            return id ? pull(*id) : INVALID_ORDER_ID;
+        }
+        if (command == "STOP")
+            return stop(fields);
+        if (command == "AUCTION")
+            return auction(fields);
+        if (command == "UNCROSS")
+            return uncross(fields, out);
+
+        return UNKNOWN_COMMAND;
+    }
+
+    // INSERT,order id,symbol,side,price,volume[,stp group[,stp mode]]
+    int NaiveEngine::insert(const std::vector<std::string_view> &fields, output_type &out)
+    {
+        if (fields.size() < 6)
+            return MALFORMED_MESSAGE;
+
+        const auto id = to_integer(fields[1], INT32_LOW, INT32_HIGH);
+        if (!id)
+            return INVALID_ORDER_ID;
+
+        if (fields[3] != "BUY" && fields[3] != "SELL")
+            return INVALID_SIDE;
+
+        const auto price = to_ticks(fields[4]);
+        if (!price)
+            return INVALID_PRICE;
+
+        const auto volume = to_integer(fields[5], 1, INT32_HIGH);
+        if (!volume)
+            return INVALID_VOLUME;
+
+        const auto group = fields.size() > 6 ? to_integer(fields[6], INT32_LOW, INT32_HIGH) : std::optional<std::int64_t>(0);
+        if (!group)
+            return INVALID_STP;
+
+        std::string mode;
+        if (*group != 0) {
+            mode = fields.size() > 7 ? std::string(fields[7]) : "CN";
+            if (mode != "CN" && mode != "CO" && mode != "CB" && mode != "DC")
+                return INVALID_STP;
+        }
+
+        // Before the book: a rejected order must not create one
+        if (find_order(*id))
+            return DUPLICATE_ORDER_ID;
+
+        auto &book = book_for(fields[2]);
+
+        const bool buy = fields[3] == "BUY";
+        side_of(book, buy).push_back({ *id, book.symbol, buy, *price, *volume, sequence_, *group, mode, Kind::LIMIT, 0 });
+        if (!book.auction)
+            match(book, out);
+
+        return ACCEPTED;
+    }
+
+    // AMEND,order id,price,volume
+    int NaiveEngine::amend(const std::vector<std::string_view> &fields, output_type &out)
+    {
+        if (fields.size() < 4)
+            return MALFORMED_MESSAGE;
+
+        const auto id = to_integer(fields[1], INT32_LOW, INT32_HIGH);
+        if (!id)
+            return INVALID_ORDER_ID;
+
+        const auto price = to_ticks(fields[2]);
+        if (!price)
+            return INVALID_PRICE;
+
+        const auto volume = to_integer(fields[3], 0, INT32_HIGH);
+        if (!volume)
+            return INVALID_VOLUME;
+
+        if (*volume == 0)
+            return pull(*id);
+
+        auto *order = find_order(*id);
+        if (!order)
+            return UNKNOWN_ORDER;
+
+        if (order->kind != Kind::LIMIT)
+            return PENDING_STOP;
+
+        auto &book = *find_book(order->symbol);
+        if (*price == order->price && *volume <= order->volume) {
+            // Keeps its place in the queue
+            order->volume = *volume;
+            order->sequence = sequence_;
+        } else {
+            auto moved = forget(book, *id);
+            moved.price = *price;
+            moved.volume = *volume;
+            moved.sequence = sequence_;
+            side_of(book, moved.buy).push_back(moved);
+        }
+
+        if (!book.auction)
+            match(book, out);
+
+        return ACCEPTED;
+    }
+
+    int NaiveEngine::pull(std::int64_t id)
+    {
+        const auto *order = find_order(id);
+        if (!order)
+            return UNKNOWN_ORDER;
+
+        forget(*find_book(order->symbol), id);
+        return ACCEPTED;
+    }
+
+    // STOP,order id,symbol,side,trigger price,volume[,limit price]
+    int NaiveEngine::stop(const std::vector<std::string_view> &fields)
+    {
+        if (fields.size() < 6)
+            return MALFORMED_MESSAGE;
+
+        const auto id = to_integer(fields[1], INT32_LOW, INT32_HIGH);
+        if (!id)
+            return INVALID_ORDER_ID;
+
+        if (fields[3] != "BUY" && fields[3] != "SELL")
+            return INVALID_SIDE;
+
+        const auto trigger = to_ticks(fields[4]);
+        if (!trigger)
+            return INVALID_PRICE;
+
+        const auto volume = to_integer(fields[5], 1, INT32_HIGH);
+        if (!volume)
+            return INVALID_VOLUME;
+
+        const auto limit = fields.size() > 6 ? to_ticks(fields[6]) : trigger;
+        if (!limit)
+            return INVALID_PRICE;
+
+        if (find_order(*id))
+            return DUPLICATE_ORDER_ID;
+
+        auto &book = book_for(fields[2]);
+
+        const auto kind = fields.size() > 6 ? Kind::STOP_LIMIT : Kind::STOP_LOSS;
+        book.stops.push_back({ *id, book.symbol, fields[3] == "BUY", *limit, *volume, sequence_, 0, "", kind, *trigger });
+        return ACCEPTED;
+    }
+
+    int NaiveEngine::auction(const std::vector<std::string_view> &fields)
+    {
+        if (fields.size() < 2)
+            return MALFORMED_MESSAGE;
+
+        auto &book = book_for(fields[1]);
+        if (book.auction)
+            return INVALID_PHASE;
+
+        book.auction = true;
+        return ACCEPTED;
+    }
+
+    int NaiveEngine::uncross(const std::vector<std::string_view> &fields, output_type &out)
+    {
+        if (fields.size() < 2)
+            return MALFORMED_MESSAGE;
+
+        auto *book = find_book(fields[1]);
+        if (!book)
+            return UNKNOWN_SYMBOL;
+
+        if (!book->auction)
+            return INVALID_PHASE;
+
+        book->auction = false;
+        const auto at = clearing(*book);
+        while (at.volume != 0) {
+            const auto *bid = best(*book, true);
+            const auto *ask = best(*book, false);
+            if (!bid || !ask || bid->price < at.price || ask->price > at.price)
+                break;
+
+            fill(*book, bid->id, ask->id, at.price, out);
+        }
+
+        match(*book, out);
+        return ACCEPTED;
+    }
+
+    NaiveEngine::Order *NaiveEngine::find_order(std::int64_t id)
+    {
+        for (auto &book : books_) {
+            if (auto *order = find_order(book, id))
+                return order;
+        }
+
+        return nullptr;
+    }
+
+    NaiveEngine::Order *NaiveEngine::find_order(Book &book, std::int64_t id)
+    {
+        for (auto *orders : { &book.bids, &book.asks, &book.stops, &book.triggered }) {
+            auto iter = std::find_if(orders->begin(), orders->end(), [&](const Order &order) { return order.id == id; });
+            if (iter != orders->end())
+                return &*iter;
+        }
+
+        return nullptr;
+    }
+
+    NaiveEngine::Book *NaiveEngine::find_book(std::string_view symbol)
+    {
+        auto iter = std::find_if(books_.begin(), books_.end(), [&](const Book &book) { return book.symbol == symbol; });
+        return iter == books_.end() ? nullptr : &*iter;
+    }
+
+    NaiveEngine::Book &NaiveEngine::book_for(std::string_view symbol)
+    {
+        if (auto *book = find_book(symbol))
+            return *book;
+
+        books_.push_back(Book{ std::string(symbol) });
+        return books_.back();
+    }
+
+    std::vector<NaiveEngine::Order> &NaiveEngine::side_of(Book &book, bool buy)
+    {
+        return buy ? book.bids : book.asks;
+    }
+
+    // The oldest order at the best price of the side, null if there is none
+    const NaiveEngine::Order *NaiveEngine::best(Book &book, bool buy)
+    {
+        const Order *best_order = nullptr;
+        for (const auto &order : side_of(book, buy)) {
+            if (!best_order || (buy ? order.price > best_order->price : order.price < best_order->price))
+                best_order = &order;
+        }
+
+        return best_order;
+    }
+
+    // Takes the order out of wherever it is
+    NaiveEngine::Order NaiveEngine::forget(Book &book, std::int64_t id)
+    {
+        for (auto *orders : { &book.bids, &book.asks, &book.stops, &book.triggered }) {
+            auto iter = std::find_if(orders->begin(), orders->end(), [&](const Order &order) { return order.id == id; });
+            if (iter != orders->end()) {
+                auto order = std::move(*iter);
+                orders->erase(iter);
+                return order;
+            }
+        }
+
+        return {};
+    }
+
+    // Continuous trading: the best bid and ask trade for as long as they cross
+    void NaiveEngine::match(Book &book, output_type &out)
+    {
+        for (;;) {
+            const auto *bid = best(book, true);
+            const auto *ask = best(book, false);
+            if (!bid || !ask || bid->price < ask->price)
+                break;
+
+            // At the price of the one that was there first
+            fill(book, bid->id, ask->id, bid->sequence > ask->sequence ? ask->price : bid->price, out);
+        }
+
+        activate_stops(book, out);
+    }
+
+    void NaiveEngine::fill(Book &book, std::int64_t bid_id, std::int64_t ask_id, std::int64_t price, output_type &out)
+    {
+        const auto bid = *find_order(book, bid_id);
+        const auto ask = *find_order(book, ask_id);
+        if (bid.stp_group != 0 && bid.stp_group == ask.stp_group) {
+            prevent_self_trade(book, bid_id, ask_id, out);
+            return;
+        }
+
+        const auto &aggressor = bid.sequence > ask.sequence ? bid : ask;
+        const auto &passive = bid.sequence > ask.sequence ? ask : bid;
+        const auto volume = std::min(bid.volume, ask.volume);
+        out.push_back(passive.symbol + "," + price_text(price) + "," + std::to_string(volume) + ","
+                      + std::to_string(aggressor.id) + "," + std::to_string(passive.id));
+
+        trigger_stops(book, price);
+        take(book, bid_id, volume);
+        take(book, ask_id, volume);
+    }
+
+    void NaiveEngine::prevent_self_trade(Book &book, std::int64_t bid_id, std::int64_t ask_id, output_type &out)
+    {
+        const auto bid = *find_order(book, bid_id);
+        const auto ask = *find_order(book, ask_id);
+        const auto &aggressor = bid.sequence > ask.sequence ? bid : ask;
+        const auto &passive = bid.sequence > ask.sequence ? ask : bid;
+
+        if (aggressor.stp_mode == "CO") {
+            cancel(book, passive.id, passive.volume, out);
+        } else if (aggressor.stp_mode == "CB") {
+            cancel(book, passive.id, passive.volume, out);
+            cancel(book, aggressor.id, aggressor.volume, out);
+        } else if (aggressor.stp_mode == "DC") {
+            const auto volume = std::min(bid.volume, ask.volume);
+            cancel(book, passive.id, volume, out);
+            cancel(book, aggressor.id, volume, out);
+        } else {
+            cancel(book, aggressor.id, aggressor.volume, out);
+        }
+    }
+
+    // Filled or cancelled volume, the order goes once none is left
+    void NaiveEngine::take(Book &book, std::int64_t id, std::int64_t volume)
+    {
+        auto *order = find_order(book, id);
+        order->volume -= volume;
+        if (order->volume == 0)
+            forget(book, id);
+    }
+
+    void NaiveEngine::cancel(Book &book, std::int64_t id, std::int64_t volume, output_type &out)
+    {
+        out.push_back("CANCEL," + std::to_string(id) + "," + std::to_string(volume));
+        take(book, id, volume);
+    }
+
+    // Buy stops trigger at or above their price, sell stops at or below
+    void NaiveEngine::trigger_stops(Book &book, std::int64_t price)
+    {
+        std::vector<Order> pending;
+        for (auto &order : book.stops) {
+            if (order.buy ? order.trigger <= price : order.trigger >= price)
+                book.triggered.push_back(std::move(order));
+            else
+                pending.push_back(std::move(order));
+        }
+
+        book.stops.swap(pending);
+    }
+
+    void NaiveEngine::activate_stops(Book &book, output_type &out)
+    {
+        // Stops that triggered stops trigger are left to the outermost call
+        if (activating_)
+            return;
+
+        activating_ = true;
+        while (!book.triggered.empty()) {
+            // In the order they were sent
+            std::vector<std::pair<std::uint64_t, std::int64_t>> batch;
+            for (const auto &order : book.triggered)
+                batch.emplace_back(order.sequence, order.id);
+            std::sort(batch.begin(), batch.end());
+
+            for (const auto &[sequence, id] : batch)
+                activate_stop(book, id, out);
+        }
+
+        activating_ = false;
+    }
+
+    void NaiveEngine::activate_stop(Book &book, std::int64_t id, output_type &out)
+    {
+        auto order = forget(book, id);
+        order.sequence = ++sequence_;
+
+        if (order.kind == Kind::STOP_LIMIT) {
+            order.kind = Kind::LIMIT;
+            side_of(book, order.buy).push_back(order);
+            match(book, out);
+            return;
+        }
+
+        // A plain stop takes the whole other side at its worst price and never rests
+        const auto &other = side_of(book, !order.buy);
+        if (other.empty()) {
+            out.push_back("CANCEL," + std::to_string(id) + "," + std::to_string(order.volume));
+            return;
+        }
+
+        auto worst = other.front().price;
+        for (const auto &resting : other)
+            worst = order.buy ? std::max(worst, resting.price) : std::min(worst, resting.price);
+
+        order.kind = Kind::LIMIT;
+        order.price = worst;
+        side_of(book, order.buy).push_back(order);
+        match(book, out);
+
+        if (auto *left = find_order(book, id))
+            cancel(book, id, left->volume, out);
+    }
+
+    // Every price either side crosses at, swept from the highest: most volume, then least
+    // imbalance, then left over sell volume
+    NaiveEngine::Clearing NaiveEngine::clearing(Book &book)
+    {
+        Clearing best_clearing;
+        const auto *bid = best(book, true);
+        const auto *ask = best(book, false);
+        if (!bid || !ask || bid->price < ask->price)
+            return best_clearing;
+
+        std::vector<std::int64_t> prices;
+        for (const auto &order : book.bids) {
+            if (order.price >= ask->price)
+                prices.push_back(order.price);
+        }
+        for (const auto &order : book.asks) {
+            if (order.price <= bid->price)
+                prices.push_back(order.price);
+        }
+
+        std::sort(prices.begin(), prices.end(), std::greater<>());
+        prices.erase(std::unique(prices.begin(), prices.end()), prices.end());
+
+        for (auto price : prices) {
+            std::int64_t bid_volume = 0;
+            std::int64_t ask_volume = 0;
+            for (const auto &order : book.bids) {
+                if (order.price >= price)
+                    bid_volume += order.volume;
+            }
+            for (const auto &order : book.asks) {
+                if (order.price <= price)
+                    ask_volume += order.volume;
+            }
+
+            const auto volume = std::min(bid_volume, ask_volume);
+            const auto imbalance = bid_volume - ask_volume;
+            if (volume > best_clearing.volume
+                || (volume == best_clearing.volume && std::abs(imbalance) < std::abs(best_clearing.imbalance))
+                || (volume == best_clearing.volume && std::abs(imbalance) == std::abs(best_clearing.imbalance) && imbalance < 0))
+                best_clearing = { price, volume, imbalance };
+        }
+
+        return best_clearing;
+    }
+}
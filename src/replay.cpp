@@ -0,0 +1,460 @@
+#include "replay.hpp"
+#include "commands.hpp"
+#include "engine.hpp"
+#include "enums.hpp"
+#include "policies.hpp"
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <fcntl.h>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace SimpleMatchingEngine::Replay {
+    namespace {
+        constexpr const char *STP_CODES[] = { "", "CN", "CO", "CB", "DC" };
+
+        [[noreturn]] void throw_errno(const std::string &what, const std::string &path)
+        {
+            std::ostringstream oss;
+            oss << what << " " << path << ": " << std::strerror(errno);
+            throw std::runtime_error(oss.str());
+        }
+
+        void append_number(std::string &wire, std::int64_t value)
+        {
+            char buffer[24];
+            wire.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+        }
+
+        void append_price(std::string &wire, std::int64_t price)
+        {
+            char buffer[FixedPointPrice::MAX_CHARS];
+            wire.append(buffer, FixedPointPrice::format(buffer, price));
+        }
+
+        std::string_view symbol_of(const BinaryRecord &record) noexcept
+        {
+            return std::string_view(record.symbol, strnlen(record.symbol, SYMBOL_LENGTH));
+        }
+
+        // A record only ever holds what parse_insert, parse_stop and the others accept. The engine
+        // trusts parsed commands, so anything else is refused here rather than traded on.
+        void check_record(const BinaryRecord &record)
+        {
+            auto corrupt = [&](const char *what) {
+                throw std::runtime_error("Corrupt binary capture: " + std::string(what) + " for order " + std::to_string(record.order_id));
+            };
+
+            constexpr auto min_price = std::numeric_limits<std::int64_t>::min();
+            constexpr auto max_price = std::numeric_limits<std::int64_t>::max();
+            const bool has_symbol = record.symbol[0] != '\0';
+            const bool valid_side = record.side == Side::BUY || record.side == Side::SELL;
+            // The most negative tick count has no wire form, a parsed price is never that
+            const bool valid_price = record.price != min_price;
+
+            switch (record.command) {
+                case Command::INSERT:
+                    if (!has_symbol || !valid_side || !valid_price || record.volume <= 0)
+                        corrupt("invalid insert");
+
+                    // A group always comes with a mode, no group never does
+                    if (record.stp_mode > SelfTradePrevention::DECREMENT_AND_CANCEL || (record.stp_group == 0) != (record.stp_mode == SelfTradePrevention::DISABLED))
+                        corrupt("invalid STP");
+                    break;
+                case Command::AMEND:
+                    if (!valid_price || record.volume < 0)
+                        corrupt("invalid amend");
+                    break;
+                case Command::STOP:
+                    if (!has_symbol || !valid_side || !valid_price || record.volume <= 0)
+                        corrupt("invalid stop");
+
+                    if (record.type == OrderType::STOP_LOSS ? record.stp_group != 0 : record.type != OrderType::STOP_LIMIT)
+                        corrupt("invalid stop type");
+
+                    // The limit is stored as an offset from the trigger
+                    if (record.stp_group > 0 ? record.price > max_price - record.stp_group : record.price <= min_price - record.stp_group)
+                        corrupt("invalid limit price");
+                    break;
+                case Command::AUCTION:
+                case Command::UNCROSS:
+                    if (!has_symbol)
+                        corrupt("missing symbol");
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // Records go to the engine as the commands they hold, nothing is formatted or parsed again
+        void feed(MatchingEngine &engine, const BinaryRecord &record, std::string_view raw, MatchingEngine::output_type &trades)
+        {
+            check_record(record);
+            const auto side = static_cast<Side>(record.side);
+
+            switch (record.command) {
+                case Command::INSERT:
+                    engine.process(MatchingEngine::insert_command{ record.order_id, symbol_of(record), side, record.price, record.volume,
+                                                                   record.stp_group, static_cast<SelfTradePrevention>(record.stp_mode) }, trades);
+                    break;
+                case Command::AMEND:
+                    engine.process(MatchingEngine::amend_command{ record.order_id, record.price, record.volume }, trades);
+                    break;
+                case Command::PULL:
+                    engine.process(PullCommand{ record.order_id }, trades);
+                    break;
+                case Command::STOP:
+                    engine.process(MatchingEngine::stop_command{ record.order_id, symbol_of(record), side, record.price, record.volume,
+                                                                 static_cast<OrderType>(record.type), record.price + record.stp_group }, trades);
+                    break;
+                case Command::AUCTION:
+                case Command::UNCROSS:
+                    engine.process(static_cast<Command>(record.command), PhaseCommand{ symbol_of(record) }, trades);
+                    break;
+                case RAW_RECORD:
+                    engine.process(raw, trades);
+                    break;
+                default:
+                    throw std::runtime_error("Corrupt binary capture: unknown record type " + std::to_string(record.command));
+            }
+        }
+    }
+
+    MappedFile::MappedFile(const std::string &path)
+        : data_(nullptr), size_(0)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw_errno("Cannot open", path);
+
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw_errno("Cannot stat", path);
+        }
+
+        size_ = static_cast<std::size_t>(st.st_size);
+        if (size_ == 0) {
+            ::close(fd);
+            return;
+        }
+
+        // Captures are read once front to back: ask for aggressive readahead
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        void *mapped = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+
+        if (mapped == MAP_FAILED)
+            throw_errno("Cannot map", path);
+
+        ::madvise(mapped, size_, MADV_SEQUENTIAL);
+        ::madvise(mapped, size_, MADV_WILLNEED);
+        data_ = static_cast<const char *>(mapped);
+    }
+
+    MappedFile::~MappedFile()
+    {
+        if (data_)
+            ::munmap(const_cast<char *>(data_), size_);
+    }
+
+    std::optional<BinaryRecord> encode(std::string_view wire)
+    {
+        const auto tokens = tokenize(wire);
+
+        BinaryRecord record{};
+        const auto cmd = command_from_string(tokens[0]);
+        if (!cmd)
+            return std::nullopt;
+
+        record.command = *cmd;
+
+        // Only messages the engine accepts have a record: what it rejects is kept raw, byte for byte
+        switch (*cmd) {
+            case Command::INSERT:
+            {
+                InsertCommand<FixedPointPrice::value_type> command{};
+                if (parse_insert<FixedPointPrice>(tokens, command) != RejectCode::ACCEPTED || command.symbol.size() > SYMBOL_LENGTH)
+                    return std::nullopt;
+
+                record.order_id = command.order_id;
+                std::memcpy(record.symbol, command.symbol.data(), command.symbol.size());
+                record.side = command.side;
+                record.price = command.price;
+                record.volume = command.volume;
+                record.stp_group = command.stp_group;
+                record.stp_mode = command.stp_mode;
+                break;
+            }
+            case Command::AMEND:
+            {
+                AmendCommand<FixedPointPrice::value_type> command{};
+                if (parse_amend<FixedPointPrice>(tokens, command) != RejectCode::ACCEPTED)
+                    return std::nullopt;
+
+                record.order_id = command.order_id;
+                record.price = command.price;
+                record.volume = command.volume;
+                break;
+            }
+            case Command::PULL:
+            {
+                PullCommand command{};
+                if (parse_pull(tokens, command) != RejectCode::ACCEPTED)
+                    return std::nullopt;
+
+                record.order_id = command.order_id;
+                break;
+            }
+            case Command::STOP:
+            {
+                StopCommand<FixedPointPrice::value_type> command{};
+                if (parse_stop<FixedPointPrice>(tokens, command) != RejectCode::ACCEPTED || command.symbol.size() > SYMBOL_LENGTH)
+                    return std::nullopt;
+
+                const auto limit_offset = command.limit_price - command.trigger_price;
+                if (limit_offset < std::numeric_limits<std::int32_t>::min() || limit_offset > std::numeric_limits<std::int32_t>::max())
+                    return std::nullopt;
+
+                record.order_id = command.order_id;
+                std::memcpy(record.symbol, command.symbol.data(), command.symbol.size());
+                record.side = command.side;
+                record.price = command.trigger_price;
+                record.volume = command.volume;
+                record.type = command.type;
+                record.stp_group = static_cast<std::int32_t>(limit_offset);
+                break;
+            }
+            case Command::AUCTION:
+            case Command::UNCROSS:
+            {
+                PhaseCommand command{};
+                if (parse_phase(tokens, command) != RejectCode::ACCEPTED || command.symbol.size() > SYMBOL_LENGTH)
+                    return std::nullopt;
+
+                std::memcpy(record.symbol, command.symbol.data(), command.symbol.size());
+                break;
+            }
+        }
+
+        return record;
+    }
+
+    void decode(const BinaryRecord &record, std::string &wire)
+    {
+        wire.clear();
+
+        switch (record.command) {
+            case Command::INSERT:
+                wire.append("INSERT,");
+                append_number(wire, record.order_id);
+                wire.push_back(',');
+                wire.append(record.symbol, strnlen(record.symbol, SYMBOL_LENGTH));
+                wire.append(record.side == Side::BUY ? ",BUY," : ",SELL,");
+                append_price(wire, record.price);
+                wire.push_back(',');
+                append_number(wire, record.volume);
+                if (record.stp_group != 0) {
+                    wire.push_back(',');
+                    append_number(wire, record.stp_group);
+                    wire.push_back(',');
+                    wire.append(STP_CODES[record.stp_mode < std::size(STP_CODES) ? record.stp_mode : 0]);
+                }
+                break;
+            case Command::AMEND:
+                wire.append("AMEND,");
+                append_number(wire, record.order_id);
+                wire.push_back(',');
+                append_price(wire, record.price);
+                wire.push_back(',');
+                append_number(wire, record.volume);
+                break;
+            case Command::PULL:
+                wire.append("PULL,");
+                append_number(wire, record.order_id);
+                break;
+            case Command::STOP:
+                wire.append("STOP,");
+                append_number(wire, record.order_id);
+                wire.push_back(',');
+                wire.append(record.symbol, strnlen(record.symbol, SYMBOL_LENGTH));
+                wire.append(record.side == Side::BUY ? ",BUY," : ",SELL,");
+                append_price(wire, record.price);
+                wire.push_back(',');
+                append_number(wire, record.volume);
+                if (record.type == OrderType::STOP_LIMIT) {
+                    wire.push_back(',');
+                    append_price(wire, record.price + record.stp_group);
+                }
+                break;
+            case Command::AUCTION:
+            case Command::UNCROSS:
+                wire.append(record.command == Command::AUCTION ? "AUCTION," : "UNCROSS,");
+                wire.append(record.symbol, strnlen(record.symbol, SYMBOL_LENGTH));
+                break;
+            default:
+                // RAW_RECORD carries its own wire form, anything else is not a command
+                wire.append("UNKNOWN");
+                break;
+        }
+    }
+
+    void convert_to_binary(const std::string &csv_path, const std::string &binary_path)
+    {
+        MappedFile csv(csv_path);
+        std::ofstream out(binary_path, std::ios::binary | std::ios::trunc);
+        if (!out)
+            throw std::runtime_error("Cannot create " + binary_path);
+
+        out.write(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+
+        for_each_line(csv.data(), csv.size(), [&](std::string_view line) {
+            if (line.empty() || line.front() == '#')
+                return;
+
+            if (const auto record = encode(line)) {
+                out.write(reinterpret_cast<const char *>(&*record), sizeof(*record));
+                return;
+            }
+
+            BinaryRecord raw{};
+            raw.command = RAW_RECORD;
+            raw.volume = static_cast<std::int32_t>(line.size());
+            out.write(reinterpret_cast<const char *>(&raw), sizeof(raw));
+            out.write(line.data(), line.size());
+        });
+    }
+
+    PartitionResult replay_partition(const std::string &capture, const std::string &golden, bool record)
+    {
+        PartitionResult result;
+        result.capture = capture;
+
+        MappedFile input(capture);
+
+        // Trades are checked against the golden file as they are produced so memory stays flat
+        std::unique_ptr<MappedFile> expected;
+        const char *expected_cursor = nullptr;
+        const char *expected_end = nullptr;
+        std::ofstream recorded;
+
+        if (!golden.empty() && record) {
+            recorded.open(golden, std::ios::trunc);
+            if (!recorded)
+                throw std::runtime_error("Cannot create " + golden);
+        } else if (!golden.empty()) {
+            expected = std::make_unique<MappedFile>(golden);
+            expected_cursor = expected->data();
+            expected_end = expected_cursor + expected->size();
+        }
+
+        MatchingEngine engine;
+        MatchingEngine::output_type trades;
+
+        auto check = [&](const std::string &trade) {
+            if (recorded.is_open()) {
+                recorded << trade << '\n';
+                return;
+            }
+
+            if (!expected)
+                return;
+
+            std::string_view line;
+            if (expected_cursor < expected_end) {
+                const char *eol = static_cast<const char *>(std::memchr(expected_cursor, '\n', expected_end - expected_cursor));
+                if (!eol)
+                    eol = expected_end;
+
+                line = std::string_view(expected_cursor, eol - expected_cursor);
+                if (!line.empty() && line.back() == '\r')
+                    line.remove_suffix(1);
+
+                expected_cursor = eol + 1;
+            }
+
+            if (line != trade) {
+                if (result.mismatches++ == 0) {
+                    std::ostringstream oss;
+                    oss << "message " << result.messages << ": expected '" << line << "' got '" << trade << "'";
+                    result.first_mismatch = oss.str();
+                }
+            }
+        };
+
+        auto process = [&](auto &&apply) {
+            apply(trades);
+            ++result.messages;
+
+            // Rejects and cancels are part of the output and are verified like trades
+            for (const auto &trade : trades) {
+                if (trade.starts_with("REJECT,"))
+                    ++result.rejects;
+                else if (trade.starts_with("CANCEL,"))
+                    ++result.cancels;
+                else
+                    ++result.trades;
+
+                check(trade);
+            }
+
+            trades.clear();
+        };
+
+        const auto start = std::chrono::steady_clock::now();
+
+        if (is_binary(input.data(), input.size())) {
+            const char *cursor = input.data() + sizeof(BINARY_MAGIC);
+            const char *end = input.data() + input.size();
+
+            while (cursor < end) {
+                BinaryRecord record;
+                if (static_cast<std::size_t>(end - cursor) < sizeof(record))
+                    throw std::runtime_error("Truncated binary capture: " + capture);
+
+                std::memcpy(&record, cursor, sizeof(record));
+                cursor += sizeof(record);
+
+                std::string_view raw;
+                if (record.command == RAW_RECORD) {
+                    if (record.volume < 0 || end - cursor < record.volume)
+                        throw std::runtime_error("Truncated binary capture: " + capture);
+
+                    raw = std::string_view(cursor, record.volume);
+                    cursor += record.volume;
+                }
+
+                process([&](auto &trades) { feed(engine, record, raw, trades); });
+            }
+        } else {
+            for_each_line(input.data(), input.size(), [&](std::string_view line) {
+                if (line.empty() || line.front() == '#')
+                    return;
+
+                process([&](auto &trades) { engine.process(line, trades); });
+            });
+        }
+
+        // Anything left in the golden file was never produced
+        if (expected) {
+            for_each_line(expected_cursor, expected_cursor < expected_end ? expected_end - expected_cursor : 0, [&](std::string_view line) {
+                if (line.empty())
+                    return;
+
+                if (result.mismatches++ == 0)
+                    result.first_mismatch = "missing trade '" + std::string(line) + "'";
+            });
+        }
+
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+}
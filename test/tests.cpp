@@ -1,14 +1,23 @@
-#define CATCH_CONFIG_MAIN
 #include <catch2/catch_all.hpp>
 #include "../include/engine.hpp"
+#include "../include/fuzz.hpp"
+#include "../include/market_data.hpp"
+#include "../include/metrics.hpp"
+#include "../include/replay.hpp"
+#include <filesystem>
+#include <fstream>
+#include <memory>
 #include <string>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using namespace SimpleMatchingEngine;
 
+template <typename Engine = MatchingEngine>
 std::vector<std::string> run(std::vector<std::string> const& input)
 {
     std::vector<std::string> ret;
-    MatchingEngine engine;
+    Engine engine;
 
     for (auto &wire : input)
         engine.process(wire, ret);
@@ -102,11 +111,11 @@ TEST_CASE("multi symbol") {
     CHECK(result[1] == "TEST,0.3854,1,13,1");
     CHECK(result[2] == "===AAPL===");
     CHECK(result[3] == ",,21,8");
-    CHECK(result[4] == "===TSLA===");
-    CHECK(result[5] == "412,31,,");
-    CHECK(result[6] == "410.5,27,,");
-    CHECK(result[7] == "===TEST===");
-    CHECK(result[8] == ",,0.3853,5");
+    CHECK(result[4] == "===TEST===");
+    CHECK(result[5] == ",,0.3853,5");
+    CHECK(result[6] == "===TSLA===");
+    CHECK(result[7] == "412,31,,");
+    CHECK(result[8] == "410.5,27,,");
 }
 
 TEST_CASE("amend") {
@@ -153,7 +162,7 @@ TEST_CASE("mix of everything") {
 
     auto result = run(input);
 
-    REQUIRE(result.size() == 9);
+    REQUIRE(result.size() == 11);
     CHECK(result[0] == "DISC,1234.12,250,2,1");
     CHECK(result[1] == "AAPL,499,1,7,2");
     CHECK(result[2] == "AAPL,499,1,7,3");
@@ -161,8 +170,10 @@ TEST_CASE("mix of everything") {
     CHECK(result[4] == "AAPL,499,1,7,5");
     CHECK(result[5] == "AAPL,499,1,7,6");
     CHECK(result[6] == "AAPL,499,10,1,7");
-    CHECK(result[7] == "===AAPL===");
-    CHECK(result[8] == "===DISC===");
+    CHECK(result[7] == "REJECT,UNKNOWN_ORDER,1"); // both fully filled already
+    CHECK(result[8] == "REJECT,UNKNOWN_ORDER,7");
+    CHECK(result[9] == "===AAPL===");
+    CHECK(result[10] == "===DISC===");
 }
 
 TEST_CASE("catch wrong price") {
@@ -170,15 +181,29 @@ TEST_CASE("catch wrong price") {
 
     input.emplace_back("INSERT,1,DISC,BUY,1234.12345,300");
 
-    REQUIRE_THROWS(run(input));
+    auto result = run(input);
+
+    REQUIRE(result.size() == 1);
+    CHECK(result[0] == "REJECT,INVALID_PRICE,1");
 }
 
 TEST_CASE("catch wrong volume") {
     auto input = std::vector<std::string>();
 
     input.emplace_back("INSERT,1,DISC,BUY,1234.12,-300");
+    input.emplace_back("INSERT,2,DISC,BUY,1234.12,0");
+    input.emplace_back("STOP,3,DISC,BUY,1234.12,0");
+    input.emplace_back("INSERT,4,DISC,BUY,1234.12,300");
+    // Zero volume on an amend still pulls the order
+    input.emplace_back("AMEND,4,1234.12,0");
+
+    auto result = run(input);
 
-    REQUIRE_THROWS(run(input));
+    REQUIRE(result.size() == 4);
+    CHECK(result[0] == "REJECT,INVALID_VOLUME,1");
+    CHECK(result[1] == "REJECT,INVALID_VOLUME,2");
+    CHECK(result[2] == "REJECT,INVALID_VOLUME,3");
+    CHECK(result[3] == "===DISC===");
 }
 
 TEST_CASE("catch wrong command") {
@@ -186,7 +211,10 @@ TEST_CASE("catch wrong command") {
 
     input.emplace_back("WHATISTHIS,1,RACE,BUY,1234.12,300");
 
-    REQUIRE_THROWS(run(input));
+    auto result = run(input);
+
+    REQUIRE(result.size() == 1);
+    CHECK(result[0] == "REJECT,UNKNOWN_COMMAND,1");
 }
 
 TEST_CASE("catch wrong side") {
@@ -194,5 +222,649 @@ TEST_CASE("catch wrong side") {
 
     input.emplace_back("INSERT,1,RACE,IamNotBuying,1234.12,300");
 
-    REQUIRE_THROWS(run(input));
+    auto result = run(input);
+
+    REQUIRE(result.size() == 1);
+    CHECK(result[0] == "REJECT,INVALID_SIDE,1");
+}
+
+TEST_CASE("self trade prevention cancel newest") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,AAPL,BUY,12.2,5,7");
+    input.emplace_back("INSERT,2,AAPL,BUY,12.1,5");
+    input.emplace_back("INSERT,3,AAPL,SELL,12.1,8,7,CN");
+
+    auto result = run(input);
+
+    REQUIRE(result.size() == 4);
+    CHECK(result[0] == "CANCEL,3,8");
+    CHECK(result[1] == "===AAPL===");
+    CHECK(result[2] == "12.2,5,,");
+    CHECK(result[3] == "12.1,5,,");
+}
+
+TEST_CASE("self trade prevention cancel oldest") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,AAPL,BUY,12.2,5,7");
+    input.emplace_back("INSERT,2,AAPL,BUY,12.1,5");
+    input.emplace_back("INSERT,3,AAPL,SELL,12.1,8,7,CO");
+
+    auto result = run(input);
+
+    REQUIRE(result.size() == 4);
+    CHECK(result[0] == "CANCEL,1,5");
+    CHECK(result[1] == "AAPL,12.1,5,3,2");
+    CHECK(result[2] == "===AAPL===");
+    CHECK(result[3] == ",,12.1,3");
+}
+
+TEST_CASE("self trade prevention cancel both") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,AAPL,BUY,12.2,5,7");
+    input.emplace_back("INSERT,2,AAPL,BUY,12.1,5");
+    input.emplace_back("INSERT,3,AAPL,SELL,12.1,8,7,CB");
+
+    auto result = run(input);
+
+    REQUIRE(result.size() == 4);
+    CHECK(result[0] == "CANCEL,1,5");
+    CHECK(result[1] == "CANCEL,3,8");
+    CHECK(result[2] == "===AAPL===");
+    CHECK(result[3] == "12.1,5,,");
+}
+
+TEST_CASE("self trade prevention decrement and cancel") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,AAPL,BUY,12.2,5,7");
+    input.emplace_back("INSERT,2,AAPL,BUY,12.1,5");
+    input.emplace_back("INSERT,3,AAPL,SELL,12.1,8,7,DC");
+    input.emplace_back("INSERT,4,AAPL,SELL,12.1,1,8,DC"); // different group, trades
+
+    auto result = run(input);
+
+    REQUIRE(result.size() == 6);
+    CHECK(result[0] == "CANCEL,1,5");
+    CHECK(result[1] == "CANCEL,3,5");
+    CHECK(result[2] == "AAPL,12.1,3,3,2");
+    CHECK(result[3] == "AAPL,12.1,1,4,2");
+    CHECK(result[4] == "===AAPL===");
+    CHECK(result[5] == "12.1,1,,");
+}
+
+TEST_CASE("self trade prevention cancels go through the structured sink") {
+    BasicMatchingEngine<StructuredEventPolicy> engine;
+    BasicMatchingEngine<StructuredEventPolicy>::output_type events;
+
+    engine.process("INSERT,1,AAPL,BUY,12.2,5,7", events);
+    engine.process("INSERT,2,AAPL,SELL,12.1,8,7,CN", events);
+
+    REQUIRE(events.size() == 1);
+    CHECK(events[0].type == EventType::CANCEL);
+    CHECK(events[0].order_id == 2);
+    CHECK(events[0].volume == 8);
+    CHECK(events[0].price == 121000);
+    CHECK(*events[0].symbol == "AAPL");
+}
+
+TEST_CASE("metrics snapshot") {
+    auto &registry = Metrics::Registry::instance();
+    const auto before = registry.snapshot();
+
+    Metrics::local().add(Metrics::Counter::FILLS, 3);
+    Metrics::local().record(Metrics::Stage::MATCH, 100);
+
+    const auto after = registry.snapshot();
+
+    CHECK(after.threads >= 1);
+    CHECK(after.counters[Metrics::Counter::FILLS] - before.counters[Metrics::Counter::FILLS] == 3);
+    CHECK(after.stage_cycles[Metrics::Stage::MATCH] - before.stage_cycles[Metrics::Stage::MATCH] == 100);
+    CHECK(after.stage_calls[Metrics::Stage::MATCH] - before.stage_calls[Metrics::Stage::MATCH] == 1);
+}
+
+TEST_CASE("fixed point price") {
+    CHECK(FixedPointPrice::parse("12.2") == 122000);
+    CHECK(FixedPointPrice::parse("1233") == 12330000);
+    CHECK(FixedPointPrice::parse("0.3854") == 3854);
+    CHECK(FixedPointPrice::parse("-1.5") == -15000);
+    CHECK(!FixedPointPrice::parse("12.2x"));
+    CHECK(!FixedPointPrice::parse("12.23456"));
+
+    std::ostringstream oss;
+    FixedPointPrice::print(oss, 122000);
+    oss << "|";
+    FixedPointPrice::print(oss, 12330000);
+    oss << "|";
+    FixedPointPrice::print(oss, 3850);
+    CHECK(oss.str() == "12.2|1233|0.385");
+}
+
+TEST_CASE("fixed point prices out of range are rejected") {
+    CHECK(FixedPointPrice::parse("922337203685477.5807") == std::numeric_limits<std::int64_t>::max());
+    CHECK(!FixedPointPrice::parse("922337203685477.5808"));
+    CHECK(!FixedPointPrice::parse("9223372036854775807"));
+    CHECK(!FixedPointPrice::parse("--1"));
+
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,A,BUY,9223372036854775807,5");
+    input.emplace_back("INSERT,2,A,SELL,1,5");
+
+    auto result = run(input);
+
+    REQUIRE(result.size() == 3);
+    CHECK(result[0] == "REJECT,INVALID_PRICE,1");
+    CHECK(result[1] == "===A===");
+    CHECK(result[2] == ",,1,5");
+}
+
+TEST_CASE("level volume does not overflow") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,A,BUY,10,2147483647");
+    input.emplace_back("INSERT,2,A,BUY,10,2147483647");
+
+    auto result = run(input);
+
+    REQUIRE(result.size() == 2);
+    CHECK(result[1] == "10,4294967294,,");
+}
+
+TEST_CASE("policies agree") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,8,AAPL,BUY,14.235,5");
+    input.emplace_back("INSERT,6,AAPL,BUY,14.235,6");
+    input.emplace_back("INSERT,7,AAPL,BUY,14.235,12");
+    input.emplace_back("INSERT,2,AAPL,BUY,14.234,5");
+    input.emplace_back("INSERT,1,AAPL,BUY,14.23,3");
+    input.emplace_back("INSERT,5,AAPL,SELL,14.237,8");
+    input.emplace_back("INSERT,3,AAPL,SELL,14.24,9");
+    input.emplace_back("PULL,8");
+    input.emplace_back("INSERT,4,AAPL,SELL,14.234,25");
+    input.emplace_back("AMEND,3,14.235,4");
+
+    auto reference = run<BasicMatchingEngine<ReferencePolicy>>(input);
+    auto flat = run<BasicMatchingEngine<FlatBookPolicy>>(input);
+
+    CHECK(reference == flat);
+}
+
+TEST_CASE("string prices order by value and print as sent") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,AAPL,BUY,9,5");
+    input.emplace_back("INSERT,2,AAPL,BUY,10,5");
+    input.emplace_back("INSERT,3,AAPL,BUY,9.50,5");
+    input.emplace_back("INSERT,4,AAPL,BUY,9.5,2");
+    input.emplace_back("INSERT,5,AAPL,SELL,10,4");
+
+    auto result = run<BasicMatchingEngine<ReferencePolicy>>(input);
+
+    REQUIRE(result.size() == 5);
+    CHECK(result[0] == "AAPL,10,4,5,2");
+    CHECK(result[1] == "===AAPL===");
+    CHECK(result[2] == "10,1,,");
+    CHECK(result[3] == "9.50,7,,");
+    CHECK(result[4] == "9,5,,");
+}
+
+TEST_CASE("fixed point prices order numerically") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,AAPL,BUY,999,5");
+    input.emplace_back("INSERT,2,AAPL,BUY,1000,5");
+    input.emplace_back("INSERT,3,AAPL,SELL,1000,5");
+
+    auto result = run<BasicMatchingEngine<FlatBookPolicy>>(input);
+
+    REQUIRE(result.size() == 3);
+    CHECK(result[0] == "AAPL,1000,5,3,2");
+    CHECK(result[1] == "===AAPL===");
+    CHECK(result[2] == "999,5,,");
+}
+
+TEST_CASE("replay binary round trip") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,AAPL,BUY,12.2,5");
+    input.emplace_back("INSERT,2,AAPL,SELL,12.1,8,7,DC");
+    input.emplace_back("AMEND,2,12.25,3");
+    input.emplace_back("PULL,1");
+    input.emplace_back("AUCTION,AAPL");
+    input.emplace_back("UNCROSS,AAPL");
+    input.emplace_back("STOP,3,AAPL,SELL,12.1,8");
+    input.emplace_back("STOP,4,AAPL,BUY,12.1,8,12.25");
+
+    for (const auto &wire : input) {
+        const auto record = Replay::encode(wire);
+        REQUIRE(record);
+
+        std::string decoded;
+        Replay::decode(*record, decoded);
+        CHECK(decoded == wire);
+    }
+}
+
+TEST_CASE("binary captures replay like their CSV, rejects included") {
+    const auto directory = std::filesystem::temp_directory_path();
+    const auto csv = (directory / "sme_tests_capture.csv").string();
+    const auto binary = (directory / "sme_tests_capture.bin").string();
+    const auto golden = (directory / "sme_tests_capture.golden").string();
+
+    {
+        std::ofstream out(csv, std::ios::trunc);
+        out << "INSERT,1,AAPL,BUY,12.2,5\n"
+            << "INSERT,x,AAPL,BUY,12.2,5\n"
+            << "GARBAGE\n"
+            << "INSERT,2,LONGSYMBOL,SELL,12.2,1\n"
+            << "INSERT,3,AAPL,SELL,12.1,8,7,DC\n"
+            << "STOP,4,AAPL,SELL,12.1,0\n"
+            << "STOP,5,AAPL,BUY,12.3,2,12.4\n"
+            << "AMEND,3,12.25,0\n"
+            << "INSERT,6,AAPL,SELL,13,2,9\n"
+            << "INSERT,7,AAPL,BUY,13,3,9,CB\n"
+            << "AUCTION,AAPL\n";
+    }
+
+    // Rejected or too long for a record: kept raw instead of failing the conversion
+    REQUIRE_NOTHROW(Replay::convert_to_binary(csv, binary));
+
+    const auto recorded = Replay::replay_partition(csv, golden, true);
+    const auto replayed = Replay::replay_partition(binary, golden, false);
+
+    CHECK(recorded.messages == 11);
+    CHECK(recorded.rejects == 3);
+    CHECK(recorded.cancels == 2);
+    CHECK(recorded.trades == 1);
+    CHECK(replayed.messages == recorded.messages);
+    CHECK(replayed.rejects == recorded.rejects);
+    CHECK(replayed.cancels == recorded.cancels);
+    CHECK(replayed.trades == recorded.trades);
+    CHECK(replayed.mismatches == 0);
+    CHECK(replayed.first_mismatch.empty());
+
+    std::filesystem::remove(csv);
+    std::filesystem::remove(binary);
+    std::filesystem::remove(golden);
+}
+
+TEST_CASE("corrupt binary records are refused") {
+    const auto binary = (std::filesystem::temp_directory_path() / "sme_tests_corrupt.bin").string();
+
+    auto replay = [&](auto &&corrupt) {
+        auto record = *Replay::encode("INSERT,1,AAPL,BUY,12.2,5");
+        corrupt(record);
+
+        std::ofstream out(binary, std::ios::binary | std::ios::trunc);
+        out.write(Replay::BINARY_MAGIC, sizeof(Replay::BINARY_MAGIC));
+        out.write(reinterpret_cast<const char *>(&record), sizeof(record));
+        out.close();
+
+        return Replay::replay_partition(binary, "", false);
+    };
+
+    CHECK_NOTHROW(replay([](Replay::BinaryRecord &) {}));
+    CHECK_THROWS_AS(replay([](Replay::BinaryRecord &record) { record.side = 7; }), std::runtime_error);
+    CHECK_THROWS_AS(replay([](Replay::BinaryRecord &record) { record.volume = -5; }), std::runtime_error);
+    CHECK_THROWS_AS(replay([](Replay::BinaryRecord &record) { record.stp_mode = 9; }), std::runtime_error);
+    CHECK_THROWS_AS(replay([](Replay::BinaryRecord &record) { record.symbol[0] = '\0'; }), std::runtime_error);
+    CHECK_THROWS_AS(replay([](Replay::BinaryRecord &record) {
+        record.command = Command::STOP;
+        record.type = OrderType::LIMIT;
+    }), std::runtime_error);
+
+    std::filesystem::remove(binary);
+}
+
+TEST_CASE("duplicate order id leaves the live order alone") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,AAPL,BUY,12.2,5");
+    input.emplace_back("INSERT,1,AAPL,SELL,12.1,8");
+    input.emplace_back("INSERT,2,AAPL,SELL,12.2,5");
+
+    auto result = run(input);
+
+    REQUIRE(result.size() == 3);
+    CHECK(result[0] == "REJECT,DUPLICATE_ORDER_ID,1");
+    CHECK(result[1] == "AAPL,12.2,5,2,1");
+    CHECK(result[2] == "===AAPL===");
+}
+
+TEST_CASE("duplicate order id does not create a book") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,AAPL,BUY,12.2,5");
+    input.emplace_back("INSERT,1,MSFT,SELL,300,8");
+    input.emplace_back("STOP,1,TSLA,BUY,400,1");
+
+    auto result = run(input);
+
+    REQUIRE(result.size() == 4);
+    CHECK(result[0] == "REJECT,DUPLICATE_ORDER_ID,1");
+    CHECK(result[1] == "REJECT,DUPLICATE_ORDER_ID,1");
+    CHECK(result[2] == "===AAPL===");
+    CHECK(result[3] == "12.2,5,,");
+}
+
+TEST_CASE("rejects go through the structured sink") {
+    BasicMatchingEngine<StructuredEventPolicy> engine;
+    BasicMatchingEngine<StructuredEventPolicy>::output_type events;
+    events.reserve(8);
+
+    engine.process("INSERT,1,AAPL,BUY,12.2,5", events);
+    engine.process("PULL,42", events);
+    engine.process("AMEND,1", events);
+    engine.process("INSERT,2,AAPL,SELL,12.1,8", events);
+
+    REQUIRE(events.size() == 3);
+    CHECK(events[0].type == EventType::REJECT);
+    CHECK(events[0].reject_code == RejectCode::UNKNOWN_ORDER);
+    CHECK(events[0].order_id == 42);
+    CHECK(events[1].reject_code == RejectCode::MALFORMED_MESSAGE);
+    CHECK(events[1].order_id == 1);
+    CHECK(events[2].type == EventType::TRADE);
+    CHECK(events[2].order_id == 2);
+    CHECK(events[2].passive_order_id == 1);
+    CHECK(events[2].volume == 5);
+    CHECK(events[2].price == 122000);
+    CHECK(*events[2].symbol == "AAPL");
+}
+
+TEST_CASE("events go to the output of the message that caused them") {
+    MatchingEngine engine;
+
+    {
+        MatchingEngine::output_type first;
+        engine.process("INSERT,1,AAPL,BUY,10,5", first);
+        engine.process("INSERT,2,AAPL,BUY,10,3,7,CN", first);
+        CHECK(first.empty());
+    }
+
+    MatchingEngine::output_type second;
+    engine.process("INSERT,3,AAPL,SELL,10,8,7,CO", second);
+    engine.process("PULL,42", second);
+
+    REQUIRE(second.size() == 3);
+    CHECK(second[0] == "AAPL,10,5,3,1");
+    CHECK(second[1] == "CANCEL,2,3");
+    CHECK(second[2] == "REJECT,UNKNOWN_ORDER,42");
+}
+
+TEST_CASE("depth is published to shared memory") {
+    MarketData::ShmBookPublisher publisher("/sme_tests_depth", 4, 2);
+    MatchingEngine engine;
+    MatchingEngine::output_type trades;
+
+    engine.process("INSERT,1,AAPL,BUY,12.2,5", trades);
+    engine.attach_publisher(&publisher);
+    engine.process("INSERT,2,AAPL,BUY,12.2,3", trades);
+    engine.process("INSERT,3,AAPL,BUY,12.1,7", trades);
+    engine.process("INSERT,4,AAPL,BUY,12,1", trades);
+    engine.process("INSERT,5,AAPL,SELL,12.2,6", trades);
+    engine.process("INSERT,6,MSFT,SELL,300.5,10", trades);
+
+    MarketData::ShmBookReader reader("/sme_tests_depth");
+    MarketData::BookDepth depth;
+
+    const auto aapl = reader.find("AAPL");
+    REQUIRE(aapl >= 0);
+    // The third level is not published so inserting into it is not a new version
+    CHECK(reader.read(aapl, depth) == 4);
+    REQUIRE(depth.bid_depth == 2);
+    CHECK(depth.ask_depth == 0);
+    CHECK(depth.bids[0] == MarketData::Level{ 122000, 2 });
+    CHECK(depth.bids[1] == MarketData::Level{ 121000, 7 });
+
+    const auto msft = reader.find("MSFT");
+    REQUIRE(msft >= 0);
+    CHECK(reader.read(msft, depth) == 1);
+    REQUIRE(depth.ask_depth == 1);
+    CHECK(depth.asks[0] == MarketData::Level{ 3005000, 10 });
+    CHECK(reader.find("GOOG") == -1);
+}
+
+TEST_CASE("a new publisher replaces a stale segment without truncating it") {
+    // A publisher that died without cleaning up: its segment stays, its lock goes with the process
+    const auto child = ::fork();
+    REQUIRE(child >= 0);
+    if (child == 0) {
+        auto *stale = new MarketData::ShmBookPublisher("/sme_tests_stale", 2, 2);
+        MarketData::BookDepth depth;
+        depth.bid_depth = 1;
+        depth.bids[0] = { 122000, 5 };
+        stale->publish(stale->slot_for("AAPL"), depth);
+        ::_exit(0);
+    }
+    int status = 0;
+    REQUIRE(::waitpid(child, &status, 0) == child);
+    REQUIRE(WIFEXITED(status));
+
+    MarketData::ShmBookReader old_reader("/sme_tests_stale");
+    auto publisher = std::make_unique<MarketData::ShmBookPublisher>("/sme_tests_stale", 2, 2);
+    MarketData::ShmBookReader reader("/sme_tests_stale");
+
+    // Readers of the old segment still see what was published there
+    MarketData::BookDepth read;
+    CHECK(old_reader.read(old_reader.find("AAPL"), read) == 1);
+    CHECK(read.bids[0] == MarketData::Level{ 122000, 5 });
+    CHECK(reader.find("AAPL") == -1);
+
+    publisher.reset();
+    CHECK_THROWS(MarketData::ShmBookReader("/sme_tests_stale"));
+}
+
+TEST_CASE("a live publisher keeps its segment") {
+    MarketData::ShmBookPublisher publisher("/sme_tests_live", 2, 2);
+    MarketData::BookDepth depth;
+    depth.bid_depth = 1;
+    depth.bids[0] = { 122000, 5 };
+    publisher.publish(publisher.slot_for("AAPL"), depth);
+
+    CHECK_THROWS_AS(MarketData::ShmBookPublisher("/sme_tests_live", 2, 2), std::runtime_error);
+
+    MarketData::ShmBookReader reader("/sme_tests_live");
+    MarketData::BookDepth read;
+    CHECK(reader.read(reader.find("AAPL"), read) == 1);
+    CHECK(read.bids[0] == MarketData::Level{ 122000, 5 });
+}
+
+TEST_CASE("auction accumulates orders and uncrosses at the clearing price") {
+    MatchingEngine engine;
+    MatchingEngine::output_type trades;
+
+    engine.process("AUCTION,AAPL", trades);
+    engine.process("INSERT,1,AAPL,BUY,10.3,5", trades);
+    engine.process("INSERT,2,AAPL,BUY,10.1,10", trades);
+    engine.process("INSERT,3,AAPL,SELL,9.9,4", trades);
+    engine.process("INSERT,4,AAPL,SELL,10.1,6", trades);
+    engine.process("INSERT,5,AAPL,SELL,10.2,8", trades);
+    CHECK(trades.empty());
+
+    // At 10.1: 15 to buy, 10 to sell. At 10.2: 5 to buy, 18 to sell.
+    const auto indicative = engine.indicative_uncross("AAPL");
+    REQUIRE(indicative);
+    CHECK(indicative->price == 101000);
+    CHECK(indicative->volume == 10);
+    CHECK(indicative->imbalance == 5);
+    CHECK(!engine.indicative_uncross("MSFT"));
+
+    engine.process("UNCROSS,AAPL", trades);
+
+    REQUIRE(trades.size() == 3);
+    CHECK(trades[0] == "AAPL,10.1,4,3,1");
+    CHECK(trades[1] == "AAPL,10.1,1,4,1");
+    CHECK(trades[2] == "AAPL,10.1,5,4,2");
+
+    // Back to continuous trading
+    trades.clear();
+    engine.process("INSERT,6,AAPL,SELL,10.1,2", trades);
+    REQUIRE(trades.size() == 1);
+    CHECK(trades[0] == "AAPL,10.1,2,6,2");
+}
+
+TEST_CASE("indicative uncross does not truncate") {
+    MatchingEngine engine;
+    MatchingEngine::output_type trades;
+
+    engine.process("AUCTION,A", trades);
+    engine.process("INSERT,1,A,BUY,10,2147483647", trades);
+    engine.process("INSERT,2,A,BUY,10,2147483647", trades);
+    engine.process("INSERT,3,A,SELL,10,1", trades);
+
+    const auto indicative = engine.indicative_uncross("A");
+    REQUIRE(indicative);
+    CHECK(indicative->volume == 1);
+    CHECK(indicative->imbalance == 4294967293);
+}
+
+TEST_CASE("auction phase changes are validated") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("UNCROSS,AAPL");
+    input.emplace_back("AUCTION,AAPL");
+    input.emplace_back("AUCTION,AAPL");
+    input.emplace_back("INSERT,1,AAPL,BUY,12.2,5");
+    input.emplace_back("INSERT,2,AAPL,SELL,12.1,8");
+    input.emplace_back("UNCROSS,AAPL");
+    input.emplace_back("UNCROSS,AAPL");
+    input.emplace_back("AUCTION");
+
+    auto result = run(input);
+
+    REQUIRE(result.size() == 7);
+    CHECK(result[0] == "REJECT,UNKNOWN_SYMBOL,0");
+    CHECK(result[1] == "REJECT,INVALID_PHASE,0");
+    // Equal executable volume and imbalance from 12.1 to 12.2: the sell surplus pushes the price down
+    CHECK(result[2] == "AAPL,12.1,5,2,1");
+    CHECK(result[3] == "REJECT,INVALID_PHASE,0");
+    CHECK(result[4] == "REJECT,MALFORMED_MESSAGE,0");
+    CHECK(result[5] == "===AAPL===");
+    CHECK(result[6] == ",,12.1,3");
+}
+
+TEST_CASE("triggered stops cascade") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,AAPL,SELL,10.0,5");
+    input.emplace_back("INSERT,2,AAPL,SELL,10.2,5");
+    input.emplace_back("STOP,3,AAPL,BUY,10.1,4,10.2");
+    input.emplace_back("STOP,4,AAPL,BUY,10.0,3");
+    input.emplace_back("INSERT,5,AAPL,BUY,10.0,5");
+
+    auto result = run(input);
+
+    REQUIRE(result.size() == 5);
+    CHECK(result[0] == "AAPL,10,5,5,1");
+    // The plain stop takes the best offer left, that trade triggers the stop-limit
+    CHECK(result[1] == "AAPL,10.2,3,4,2");
+    CHECK(result[2] == "AAPL,10.2,2,3,2");
+    CHECK(result[3] == "===AAPL===");
+    CHECK(result[4] == "10.2,2,,");
+}
+
+TEST_CASE("stops triggered together enter in the order they were sent") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,AAPL,BUY,9.5,10");
+    input.emplace_back("INSERT,2,AAPL,BUY,9,10");
+    input.emplace_back("STOP,3,AAPL,SELL,9.5,2,9");
+    input.emplace_back("STOP,4,AAPL,SELL,10,2,9");
+    input.emplace_back("INSERT,5,AAPL,SELL,9.5,1");
+
+    auto result = run(input);
+
+    REQUIRE(result.size() == 6);
+    CHECK(result[0] == "AAPL,9.5,1,5,1");
+    CHECK(result[1] == "AAPL,9.5,2,3,1");
+    CHECK(result[2] == "AAPL,9.5,2,4,1");
+    CHECK(result[3] == "===AAPL===");
+    CHECK(result[4] == "9.5,5,,");
+    CHECK(result[5] == "9,10,,");
+}
+
+TEST_CASE("pending stops can be pulled but not amended") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,AAPL,BUY,10,5");
+    input.emplace_back("STOP,2,AAPL,SELL,10,3");
+    input.emplace_back("AMEND,2,10,1");
+    input.emplace_back("STOP,3,AAPL,SELL,11,3");
+    input.emplace_back("PULL,2");
+    input.emplace_back("INSERT,4,AAPL,SELL,10,5");
+    // Nothing was left to sell into, the stop is gone
+    input.emplace_back("PULL,3");
+
+    auto result = run(input);
+
+    REQUIRE(result.size() == 5);
+    CHECK(result[0] == "REJECT,PENDING_STOP,2");
+    CHECK(result[1] == "AAPL,10,5,4,1");
+    CHECK(result[2] == "CANCEL,3,3");
+    CHECK(result[3] == "REJECT,UNKNOWN_ORDER,3");
+    CHECK(result[4] == "===AAPL===");
+}
+
+TEST_CASE("a triggered plain stop cancels what it could not fill") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,AAPL,SELL,10,5");
+    input.emplace_back("INSERT,2,AAPL,SELL,10.2,2");
+    input.emplace_back("STOP,3,AAPL,BUY,10,5");
+    input.emplace_back("INSERT,4,AAPL,BUY,10,5");
+
+    auto result = run(input);
+
+    REQUIRE(result.size() == 4);
+    CHECK(result[0] == "AAPL,10,5,4,1");
+    CHECK(result[1] == "AAPL,10.2,2,3,2");
+    CHECK(result[2] == "CANCEL,3,3");
+    CHECK(result[3] == "===AAPL===");
+}
+
+TEST_CASE("prices of different widths order by value") {
+    auto input = std::vector<std::string>();
+
+    input.emplace_back("INSERT,1,AAPL,SELL,10,5");
+    input.emplace_back("INSERT,2,AAPL,SELL,9.5,5");
+    input.emplace_back("INSERT,3,AAPL,BUY,-0.5,1");
+    input.emplace_back("INSERT,4,AAPL,BUY,010.0000,7");
+
+    const std::vector<std::string> expected = { "AAPL,9.5,5,4,2", "AAPL,10,2,4,1", "===AAPL===", "-0.5,1,10,3" };
+    CHECK(run<MatchingEngine>(input) == expected);
+    CHECK(run<BasicMatchingEngine<FlatBookPolicy>>(input) == expected);
+    CHECK(run<Fuzz::NaiveEngine>(input) == expected);
+}
+
+TEST_CASE("optimized books match the naive engine") {
+    for (std::uint64_t seed = 1; seed <= 3; ++seed) {
+        const auto messages = Fuzz::generate({ seed, 3000, 2 });
+
+        const auto flat_book = Fuzz::compare<BasicMatchingEngine<FlatBookPolicy>>(messages);
+        CHECK(!flat_book);
+
+        const auto fixed_point = Fuzz::compare<MatchingEngine>(messages);
+        CHECK(!fixed_point);
+    }
+}
+
+TEST_CASE("fuzz failures shrink to a minimal reproducer") {
+    const auto messages = Fuzz::generate({ 7, 500, 2 });
+    auto fails = [](const std::vector<std::string> &candidate) {
+        const auto has = [&](std::string_view prefix) {
+            return std::any_of(candidate.begin(), candidate.end(), [&](const std::string &wire) { return wire.starts_with(prefix); });
+        };
+
+        return has("AUCTION,") && has("STOP,");
+    };
+
+    REQUIRE(fails(messages));
+    const auto reproducer = Fuzz::shrink(messages, fails);
+
+    REQUIRE(reproducer.size() == 2);
+    CHECK(fails(reproducer));
 }